@@ -19,16 +19,24 @@ static const int MaxPlayers = 26;      // maximum number of players
 static const int GoldTotal = 250;      // number of gold nuggets in the game
 static const int GoldMinNumPiles = 10;  // minimum number of gold piles
 static const int GoldMaxNumPiles = 30;  // maximum number of gold piles
+static const int MaxChangedIdxs = 32;   // changed spots checked one by one; beyond this every player updates
 
 /**************** global types ***************/
+typedef struct playerView {
+  char* display;  // DISPLAY message last sent to the player, their grid rendered in after the header
+  int renderedLoc;  // where the player stood when it was rendered
+  long renderedVersion;  // version of the master grid it was rendered at
+} playerView_t;
+
 typedef struct game {
   player_t** playerArray;
   grid_t* grid;
   player_t* spectator;
   int nextPlayerNumber;
   int numPlayersQuit;
-  int pilesRemaining;
   int nuggetsRemaining;
+  playerView_t* views;  // each player's display as last sent, patched for the next one
+  long lastVersion;  // version of the master grid when players were last updated
 } game_t;
 
 /**************** local function prototypes  ****************/
@@ -40,6 +48,7 @@ static void sendGold(addr_t* address, int justCollected, int updatedPurse,
                      int nuggetsRemaining);
 static void sendGrid(addr_t* address, int numRows, int numCols);
 static void sendDisplay(addr_t* address, char* gridString);
+static bool sendPlayerDisplay(game_t* game, int playerNumber);
 
 
 /**************** global functions ****************/
@@ -55,15 +64,23 @@ game_new(char* mapName) {
       // starts empty, allows up to MaxPlayers to join
       game->playerArray = calloc(MaxPlayers, sizeof(player_t*));
       // grid initialization handled by grid module
-      game->grid = grid_initialize(mapName, GoldMinNumPiles, GoldMaxNumPiles, &(game->pilesRemaining));
+      int numPiles;  // the grid keeps count of the piles left from here on
+      game->grid = grid_initialize(mapName, GoldMinNumPiles, GoldMaxNumPiles, &numPiles);
       if (game->grid == NULL){
         return NULL;
         fprintf(stderr, "game_newGame: error initializing grid\n");
       }
+      // a display per player, allocated when first sent
+      game->views = calloc(MaxPlayers, sizeof(playerView_t));
+      if (game->views == NULL){
+        fprintf(stderr, "game_new: error allocating player displays\n");
+        return NULL;
+      }
       game->nextPlayerNumber = 0;
       game->numPlayersQuit = 0;
       game->spectator = NULL;
       game->nuggetsRemaining = GoldTotal;
+      game->lastVersion = grid_getVersion(game->grid);
       return game; // initialized game pointer
     }
     else { // game memory allocation error
@@ -77,6 +94,30 @@ game_new(char* mapName) {
   }
 }
 
+/*************** game_setLightRadius() ***************/
+/* see game.h for documentation */
+bool
+game_setLightRadius(game_t* game, int radius) {
+  if (game != NULL) { // check game param
+    return grid_setLightRadius(game->grid, radius);
+  }
+  fprintf(stderr, "game_setLightRadius: called with NULL game\n");
+  return false;
+}
+
+/*************** game_getBuildStats() ***************/
+/* see game.h for documentation */
+bool
+game_getBuildStats(game_t* game, const char** engine, int* numThreads, double* buildSeconds,
+                   long* memoryBytes) {
+  if (game != NULL && engine != NULL) { // check game param
+    *engine = grid_getEngine(game->grid);
+    return grid_getBuildStats(game->grid, numThreads, buildSeconds, memoryBytes);
+  }
+  fprintf(stderr, "game_getBuildStats: called with NULL game\n");
+  return false;
+}
+
 /*************** game_newPlayer() ***************/
 /* see game.h for documentation */
 bool
@@ -113,7 +154,7 @@ game_newPlayer(game_t* game, addr_t* address, char* realName) {
           sendOK(address, letter);
           sendGrid(address, grid_getNR(game->grid), grid_getNC(game->grid));
           sendGold(address, 0, player_getPurse(player), game->nuggetsRemaining);
-          sendDisplay(address, player_getGrid(player));   
+          sendPlayerDisplay(game, game->nextPlayerNumber); // player's first look around
           if (updateAllPlayers(game, player, 0) != 0){ // update all player's grids
             fprintf(stderr, "game_newPlayer: error updating all players\n");
             return false;
@@ -152,20 +193,12 @@ game_newSpectator(game_t* game, addr_t* address){
       }
       player_t* player = player_new(address, "", MaxNameLength); // create new player without name
       if (player != NULL) { // make sure successful
-        char* grid = malloc(strlen(grid_getMasterGrid(game->grid)) + 1);
-        if (grid != NULL) {
-          strcpy(grid, grid_getMasterGrid(game->grid)); // copy masterGrid for spectator
-          sendGrid(address, grid_getNR(game->grid), grid_getNC(game->grid));
-          sendGold(address, 0, 0, game->nuggetsRemaining);
-          sendDisplay(address, grid);
-          player_setGrid(player, grid); // set player's grid to grid
-          free(grid);
-          game->spectator = player;
-          return true; // successfully added spectator
-        }
-        else { // defense check memory allocation
-          fprintf(stderr, "game_newSpectator: error allocating grid\n");
-        }
+        // spectator sees everything, so is always sent the master grid
+        sendGrid(address, grid_getNR(game->grid), grid_getNC(game->grid));
+        sendGold(address, 0, 0, game->nuggetsRemaining);
+        sendDisplay(address, grid_getMasterGrid(game->grid));
+        game->spectator = player;
+        return true; // successfully added spectator
       }
       else { // defense check memory allocation
         fprintf(stderr, "game_newSpectator: error allocating player\n");
@@ -274,24 +307,25 @@ game_playerMove(game_t* game, addr_t* address, char commandKey){
     }
     // player hits gold pile
     else if (destinationChar == '*') {
+      int pilesRemaining = grid_getNumPiles(game->grid);
+      grid_removePile(game->grid, destinationIdx); // pile leaves the grid's gold index as it's picked up
       // not last pile
-      if (game->pilesRemaining > 1) {
-        int maxInPile = 10 + game->nuggetsRemaining / game->pilesRemaining;
+      if (pilesRemaining > 1) {
+        int maxInPile = 10 + game->nuggetsRemaining / pilesRemaining;
         goldChange = rand() % maxInPile + 1; // calculate random amount of gold in pile
         game->nuggetsRemaining -= goldChange;
-        game->pilesRemaining -= 1;
         player_addPurse(player, goldChange); // give gold to player purse
       }
       // last pile
-      else if (game->pilesRemaining == 1) {
+      else if (pilesRemaining == 1) {
         goldChange = game->nuggetsRemaining; //
         player_addPurse(player, goldChange);
         sendGold(player_getAddr(player), goldChange, player_getPurse(player), game->nuggetsRemaining);
         game_endGame(game);
         return -1;
       }
-      char* originalGrid = grid_getOriginalGrid(game->grid); 
-      grid_updateMaster(game->grid, player_getLoc(player), originalGrid[player_getLoc(player)]); // switch gold pile to origin character
+      char originalChar = grid_getOriginalChar(game->grid, player_getLoc(player));
+      grid_updateMaster(game->grid, player_getLoc(player), originalChar); // switch gold pile to origin character
       grid_updateMaster(game->grid, destinationIdx, playerChar); // update master with player
       player_setLoc(player, destinationIdx); // update player location
     }
@@ -301,8 +335,8 @@ game_playerMove(game_t* game, addr_t* address, char commandKey){
     }
     else{
       // update player's location with original grid and move player
-      char* originalGrid = grid_getOriginalGrid(game->grid); 
-      grid_updateMaster(game->grid, player_getLoc(player), originalGrid[player_getLoc(player)]);
+      char originalChar = grid_getOriginalChar(game->grid, player_getLoc(player));
+      grid_updateMaster(game->grid, player_getLoc(player), originalChar);
       grid_updateMaster(game->grid, destinationIdx, playerChar);
       player_setLoc(player, destinationIdx);
     }             
@@ -373,6 +407,8 @@ playerQuit(game_t* game, addr_t* address) {
           if (player_getStatus(game->playerArray[i])) { // if still playing
             grid_updateMaster(game->grid, player_getLoc(game->playerArray[i]), '!'); // update master (!) is remove character indicator
             player_quitGame(game->playerArray[i]); 
+            free(game->views[i].display); // no longer listening, so no display to patch
+            game->views[i].display = NULL;
             message_send(*address, "QUIT Thanks for playing!");
             game->numPlayersQuit++; // increment playersQuit
             if (game->numPlayersQuit == MaxPlayers){ // check if game can still accept players
@@ -468,6 +504,10 @@ game_endGame(game_t* game) {
       player_delete(game->spectator); // delete spectator
     }
     free(summary);
+    for (int i = 0; i < MaxPlayers; i++) {
+      free(game->views[i].display);
+    }
+    free(game->views);
     free(game);
   }
   else { // game NULL
@@ -477,30 +517,45 @@ game_endGame(game_t* game) {
 
 /*************** updateAllPlayers() *************/
 /* 
- * loops through all players and spectator
- * sends updated display and gold if applicable
+ * loops through all players still in the game and spectator
+ * sends updated display to every player who can see one of the spots changed
+ * in the master grid since the last update (players standing on a changed
+ * spot always count), and gold if applicable
+ * too many changed spots, or too old a last update, and every player updates
+ * player grids are rendered from what each player has seen and can see now
  * returns 0 if successful, 1 if error, and -1 if fatal error
  */
 static int updateAllPlayers(game_t* game, player_t* movedPlayer, int goldChange){
   if (game != NULL) { // check game param
     if (movedPlayer != NULL) { // check movedPlayer param
-      // if game has spectator update display and gold if change
+      int changedIdxs[MaxChangedIdxs];
+      int numChanged = grid_getChangesSince(game->grid, game->lastVersion, changedIdxs, MaxChangedIdxs);
+      bool allChanged = (numChanged < 0 || numChanged > MaxChangedIdxs);
+      game->lastVersion = grid_getVersion(game->grid);
+      // if game has spectator update display if anything changed, and gold if change
       if (game->spectator != NULL){
-        sendDisplay(player_getAddr(game->spectator), grid_getMasterGrid(game->grid));
+        if (numChanged != 0) {
+          sendDisplay(player_getAddr(game->spectator), grid_getMasterGrid(game->grid));
+        }
         if (goldChange > 0){
           sendGold(player_getAddr(game->spectator), 0, 0, game->nuggetsRemaining);
         }
       } 
       // looop through all players and send updated displays and gold    
       for (int i = 0; i < game->nextPlayerNumber; i++) {
-        char* updatedGrid = grid_updatePlayerGrid(game->grid, game->playerArray[i]);
-        if (updatedGrid == NULL) {
-          fprintf(stderr, "updateAllGrids: updatePlayerGrid failed: FATAL ERROR\n");
-          return -1;
+        // players who quit are no longer listening
+        if (!player_getStatus(game->playerArray[i])) {
+          continue;
+        }
+        // players who can't see any changed spot have nothing new to display
+        int playerLoc = player_getLoc(game->playerArray[i]);
+        // (anyone who moved stands on a changed spot, so what they've seen is always kept up to date)
+        if (allChanged || grid_canSeeAny(game->grid, playerLoc, changedIdxs, numChanged)) {
+          if (!sendPlayerDisplay(game, i)) {
+            fprintf(stderr, "updateAllGrids: renderPlayerGrid failed: FATAL ERROR\n");
+            return -1;
+          }
         }
-        sendDisplay(player_getAddr(game->playerArray[i]), updatedGrid);
-        player_setGrid(game->playerArray[i], updatedGrid); // update player's grid
-        free(updatedGrid);
         if (goldChange > 0){ // if gold changed send gold messages
           // if player is the player that moved include just collected gold, and updated purse  
           if (game->playerArray[i] == movedPlayer) {
@@ -610,3 +665,46 @@ static void sendDisplay(addr_t* address, char* gridString) {
     fprintf(stderr, "sendDisplay: invalid arguments\n");
   }
 }
+
+/*************** sendPlayerDisplay() *************/
+/*
+ * renders a player's grid into their display message and sends it: the first
+ * display in full, then each patched with what changed since the last one
+ * returns true if successful, false if the grid couldn't be rendered
+*/
+static bool sendPlayerDisplay(game_t* game, int playerNumber) {
+  player_t* player = game->playerArray[playerNumber];
+  playerView_t* view = &game->views[playerNumber];
+  int headerLength = strlen("DISPLAY\n");
+  int bufferSize = grid_getLength(game->grid) + 1;
+  bool rendered;
+  if (view->display == NULL) {
+    // room for the header and a whole grid, so the display never needs allocating again
+    view->display = malloc(headerLength + bufferSize);
+    if (view->display == NULL) {
+      fprintf(stderr, "sendPlayerDisplay: error allocating display\n");
+      return false;
+    }
+    strcpy(view->display, "DISPLAY\n");
+    rendered = grid_renderPlayerGrid(game->grid, player, view->display + headerLength, bufferSize);
+  }
+  else {
+    // with too many changes to list, or changes too old to be remembered, the whole grid is rendered instead
+    int changedIdxs[MaxChangedIdxs];
+    int numChanged = grid_getChangesSince(game->grid, view->renderedVersion, changedIdxs, MaxChangedIdxs);
+    rendered = grid_renderPlayerStep(game->grid, player, view->renderedLoc, changedIdxs,
+                                     (numChanged > MaxChangedIdxs) ? -1 : numChanged,
+                                     view->display + headerLength, bufferSize);
+  }
+  if (!rendered) {
+    fprintf(stderr, "sendPlayerDisplay: error rendering player's grid\n");
+    free(view->display);  // may be part patched, so the next one is rendered in full
+    view->display = NULL;
+    return false;
+  }
+  view->renderedLoc = player_getLoc(player);
+  view->renderedVersion = grid_getVersion(game->grid);
+  fprintf(stderr, "sendDisplay:\n"); // log to stderr
+  message_send(*(player_getAddr(player)), view->display); // send message
+  return true;
+}
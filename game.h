@@ -28,6 +28,36 @@ typedef struct game game_t;
  */
 game_t* game_new(char* mapName);
 
+/**************** game_setLightRadius ****************/
+/* Limit how far players can see in a game.
+ *
+ * Caller provides:
+ *   valid game pointer
+ *   radius in grid cells, 0 for no limit (the default)
+ * We guarantee:
+ *   players see nothing beyond that distance from their spot
+ * We return:
+ *   true if successful else false
+ * Notes:
+ *   call before any players join; a radius set with grid_setDefaultLightRadius before game_new
+ *   has the grid's tables built for it, and can then only be narrowed
+ */
+bool game_setLightRadius(game_t* game, int radius);
+
+/**************** game_getBuildStats ****************/
+/* Report which visibility engine the game uses and how it was built at load.
+ *
+ * Caller provides:
+ *   valid game pointer
+ *   pointers for the engine's name, number of threads, build time in seconds and memory in bytes
+ * We guarantee:
+ *   all four filled in if successful
+ * We return:
+ *   true if successful else false
+ */
+bool game_getBuildStats(game_t* game, const char** engine, int* numThreads, double* buildSeconds,
+                        long* memoryBytes);
+
 /**************** game_newPlayer ****************/
 /* Create new player and add to playerArray
  * If successful, send GRID, GOLD and DISPLAY messages to client
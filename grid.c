@@ -4,12 +4,23 @@
  * Liam Prevelige, Lily Scott, Eliza Crocker May 2021
  */
 
+#define _POSIX_C_SOURCE 200809L  // clock_gettime, sysconf, mmap
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <ctype.h>
-#include "file.h"
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
 #include "grid.h"
 #include "player.h"
 
@@ -23,18 +34,254 @@ static const char RoomSpot = '.';
 static const char Passage = '#';
 static const char MyPlayer = '@';
 static const char GoldSpot = '*';
+// Characters a map is made of, in the order of the 4-bit codes the original grid is packed into
+static const char TerrainChars[] = {' ', '-', '|', '+', '.', '#', '\n'};
+static const int NumTerrainChars = sizeof(TerrainChars);
 
-static const float ErrorMargin = 0.0001; // error margin to account for equality due to rounding issues  
 static const float OrigCharIndicator = '!';  // indicator character for replacing with character in original grid 
+static const long DefaultCacheBytes = 16L * 1024 * 1024;  // FOV cache budget for maps without a visibility table
+static const int MaxBuildThreads = 64;  // most worker threads used to build the visibility tables
+static const int ViewerChunk = 64;  // grid indices a worker claims at a time while building visTable
+static const int OpacityTileShift = 3;  // tiled opacity bitmaps hold 64 columns of 8 rows per 64-byte cache line
+static const int ChangeLogSize = 4096;  // most recent changes to the master grid a grid remembers
 
 /************* global types ************/
 typedef struct grid {
   int numRows;  // number of rows in 2D representation of grid string
   int numColumns;  // number of columns in 2D representation of grid string
   char* masterGrid;  // string with current map and game-state information (i.e. players, gold)
-  char* originalGrid; // string with original map loaded from file (only rocks, walls/corners, hallways)
+  unsigned char* packedOriginal;  // original map loaded from file, two cells per byte as codes into TerrainChars (low nibble first)
+  char* originalGrid;  // string unpacked from it on the first grid_getOriginalGrid, NULL until then
+  int gridLength;  // characters in either grid string, may be short a trailing newline
+  int gridWords;  // number of 64-bit words in a bitset with one bit per grid index
+  uint64_t* opacity;  // bitmap of the cells whose original character blocks sight, laid out as opacityWord says
+  int opacityColumnWords;  // words it takes to cover the columns of one row
+  int opacityTileShift;  // log2 of the rows sharing each run of opacity words: 0 row by row, OpacityTileShift tiled
+  unsigned char* passageDegree;  // passages up/down/left/right of each passage in the original grid, 0 elsewhere
+  int numViewers;  // number of traversable cells, i.e. rows in visTable
+  int* viewerSlot;  // row in visTable for each grid index, -1 if the cell can't hold a player
+  uint64_t* visTable;  // per-viewer bitset of visible grid indices, NULL if the map is too big to precompute
+  int viewerWords;  // number of 64-bit words in a bitset with one bit per viewer slot
+  uint64_t* seenByTable;  // reverse of visTable: per-viewer bitset of the viewer slots that can see it, NULL without visTable
+  long* runStart;  // first run of each viewer slot's visible set in visRuns, then the total number of runs
+  struct visRun* visRuns;  // visible sets as runs of consecutive grid indices, for maps too big for visTable; NULL otherwise
+  long cacheBudget;  // bytes the FOV cache may use, 0 to disable it
+  struct fovCache* fovCache;  // recently swept visibility rows, used in place of visTable; NULL until first needed
+  long cacheHits;  // lookups answered by fovCache
+  long cacheMisses;  // lookups fovCache had to sweep
+  int* regionOf;  // region id of each grid index, -1 if players can't stand there
+  bool cullRooms;  // views are cast through the regions (castThroughRooms) rather than swept (sweepVisible)
+  int numRegions;
+  struct region* regions;  // rooms, doorways and passage segments, indexed by region id
+  int lightRadius;  // how far players can see, 0 for no limit
+  int* lightSpan;  // columns either side of a player lit at each row distance up to lightRadius
+  int builtRadius;  // lightRadius the visibility tables were built with, 0 for no limit or no tables
+  int numPiles;  // gold piles still on the map
+  bool* pileAt;  // whether each grid index holds a pile still on the map
+  long version;  // number of changes made to masterGrid since load
+  int* changeLog;  // grid index of each of the last ChangeLogSize changes, change v at (v - 1) % ChangeLogSize
+  long* rowVersion;  // version of the last change to each row, 0 if it never changed
+  uint64_t* changeMarks;  // bitset of grid indices, set only while grid_getChangesSince counts each once
+  const struct visEngine* engine;  // how this grid answers which cells a spot can see, picked at load
+  int buildThreads;  // worker threads the visibility tables were built on
+  double buildSeconds;  // wall-clock time taken to build the tables at load
 } grid_t;
 
+// A way of answering which cells a spot can see, each grid picking one at load
+typedef struct visEngine {
+  const char* name;
+  bool (*build)(grid_t* grid);  // set up at load; false if over budget or out of memory, leaving nothing behind
+  uint64_t* (*getRow)(grid_t* grid, int playerIdx, bool* isCast);  // as getVisibleRow
+  bool (*canSee)(grid_t* grid, int playerIdx, int cellIdx);  // true if cellIdx is visible from playerIdx
+} visEngine_t;
+
+// A connected set of traversable cells of one kind
+typedef struct region {
+  regionType_t type;
+  int minRow;  // bounding box, inclusive
+  int minCol;
+  int maxRow;
+  int maxCol;
+  int numCells;
+  bool isRect;  // room filling its whole bounding box, so every cell sees every other
+  int numNeighbors;  // regions with a cell one step away (8 directions)
+  int* neighbors;
+} region_t;
+
+// Consecutive grid indices in a compressed visible set
+typedef struct visRun {
+  int first;
+  int length;
+} visRun_t;
+
+// Least recently used cache of visibility rows keyed by grid index, shared by every player on a grid
+typedef struct fovCache {
+  int capacity;  // number of rows that fit in the budget
+  int numUsed;  // number of entries holding a row
+  int* entryOf;  // entry holding each grid index's row, -1 if not cached
+  int* entryIdx;  // grid index whose row each entry holds
+  int* prev;  // neighbors of each entry in the recency list, -1 at the ends
+  int* next;
+  int head;  // most recently used entry
+  int tail;  // least recently used entry, evicted first
+  uint64_t* rows;  // capacity rows of gridWords words
+} fovCache_t;
+
+// One character, or pair of characters, a line of sight must not be blocked by, as an offset from the line's start
+typedef struct rayCheck {
+  short row;  // rows above the start
+  short col;  // columns toward the end
+  short pairRow;  // second character of the pair, equal to (row, col) when the line hits a single character
+  short pairCol;
+} rayCheck_t;
+
+// Every check on the line from a start point to the point rowDist rows up and colDist columns across
+typedef struct rayTemplate {
+  int numChecks;
+  rayCheck_t checks[];
+} rayTemplate_t;
+
+// A line of sight still to be walked along its ray template, from (startRow, startCol)
+typedef struct rayWalk {
+  rayTemplate_t* ray;
+  int startRow;
+  int startCol;
+  int colStep;  // 1 if the template is followed rightward, -1 if mirrored
+} rayWalk_t;
+
+// What's left to decide whether a line of sight is clear
+typedef enum lineVerdict { LineBlocked, LineClear, LineToWalk } lineVerdict_t;
+
+// Lines of sight from one player waiting to be walked together by walkRays
+enum { RayBatchSize = 8 };
+typedef struct rayBatch {
+  int playerIdx;
+  int numRays;
+  rayWalk_t walks[RayBatchSize];
+  int cellIdxs[RayBatchSize];  // cell each line of sight ends at
+} rayBatch_t;
+
+// One of the threads building a grid's visibility tables
+typedef struct buildWorker {
+  grid_t* grid;
+  int id;  // 0 to numWorkers - 1
+  int numWorkers;
+  int* nextViewer;  // next grid index for a worker to claim, shared by every worker
+  void* data;  // anything else the work needs, shared by every worker
+} buildWorker_t;
+
+// Runs one worker encoded while building visRuns, before they're gathered in slot order
+typedef struct runBuffer {
+  visRun_t* runs;
+  long numRuns;
+  long capacity;
+  bool failed;  // ran out of memory
+} runBuffer_t;
+
+// Shared state of the workers building visRuns
+typedef struct runBuild {
+  runBuffer_t* buffers;  // one per worker
+  long* firstRun;  // each viewer slot's first run in its worker's buffer
+  int* numRuns;  // and how many runs it has
+  unsigned char* builtBy;  // worker that encoded each viewer slot
+  long totalRuns;  // runs encoded so far by every worker
+  long maxRuns;  // runs the budget has room for, past which workers give up
+} runBuild_t;
+
+/**************** file-local global variables ****************/
+// Ray templates only depend on the offset between the two points, so one table is shared by every grid
+static rayTemplate_t** rayTemplates = NULL;  // indexed by rowDist * templateColumns + colDist, built lazily
+static int templateRows = 0;  // rowDist values covered by rayTemplates
+static int templateColumns = 0;  // colDist values covered by rayTemplates
+static long templateBytes = 0;  // memory rayTemplates and every template in it take
+static int numLiveGrids = 0;  // the template table is freed along with the last grid
+static pthread_mutex_t templateLock = PTHREAD_MUTEX_INITIALIZER;  // held while a template is built, as workers share the table
+static int buildThreads = 0;  // worker threads for the next grid's tables, 0 for one per online core
+// Walks a batch of lines of sight, returning a bitmask of the clear ones; chosen for this CPU on first use
+static unsigned (*walkRays)(grid_t* grid, rayWalk_t* walks, int numRays) = NULL;
+static long tableBudget = 64L * 1024 * 1024;  // most memory the next grid's visibility engine may use
+static const visEngine_t* chosenEngine = NULL;  // engine for the next grid, NULL for the best one within budget
+static bool tiledTerrain = false;  // lay the next grid's opacity bitmap out in tiles rather than row by row
+static bool roomCulling = true;  // cast the next grid's views through its rooms rather than sweeping
+static int loadLightRadius = 0;  // light radius the next grid starts with, and builds its tables for
+
+/************** local functions ***********/
+static bool buildPileIndex(grid_t* grid, int numPiles);
+static bool startChangeLog(grid_t* grid);
+static void setMasterChar(grid_t* grid, int idx, char newChar);
+static void buildRegions(grid_t* grid);
+static bool addRegionNeighbor(region_t* region, int neighborId);
+static void pickEngine(grid_t* grid);
+static void buildViewerSlots(grid_t* grid);
+static bool buildVisTable(grid_t* grid);
+static void buildSeenByTable(grid_t* grid);
+static int numBuildWorkers(grid_t* grid);
+static void runBuildWorkers(grid_t* grid, int numWorkers, void* (*work)(void*), void* data);
+static void* buildVisRows(void* arg);
+static void* buildSeenByRows(void* arg);
+static bool buildVisRuns(grid_t* grid);
+static void* buildRunRows(void* arg);
+static bool appendRuns(runBuffer_t* buffer, uint64_t* visRow, int gridWords);
+static bool runsContain(grid_t* grid, int slot, int idx);
+static void castVisible(grid_t* grid, int playerIdx, uint64_t* visRow);
+static void castThroughRooms(grid_t* grid, int playerIdx, uint64_t* visRow);
+static void sweepVisible(grid_t* grid, int playerIdx, uint64_t* visRow);
+static void testVisible(grid_t* grid, rayBatch_t* batch, int idx, uint64_t* visRow);
+static void flushRays(grid_t* grid, rayBatch_t* batch, uint64_t* visRow);
+static void setBitRange(uint64_t* bits, int first, int last);
+static uint64_t* getVisibleRow(grid_t* grid, int playerIdx, bool* isCast);
+static uint64_t* getTableRow(grid_t* grid, int playerIdx, bool* isCast);
+static uint64_t* getRunRow(grid_t* grid, int playerIdx, bool* isCast);
+static uint64_t* getCacheRow(grid_t* grid, int playerIdx, bool* isCast);
+static uint64_t* castRow(grid_t* grid, int playerIdx, bool* isCast);
+static bool tableCanSee(grid_t* grid, int playerIdx, int cellIdx);
+static bool runsCanSee(grid_t* grid, int playerIdx, int cellIdx);
+static bool castCanSee(grid_t* grid, int playerIdx, int cellIdx);
+static bool startCache(grid_t* grid);
+static bool startRays(grid_t* grid);
+static fovCache_t* newFovCache(grid_t* grid);
+static uint64_t* getCachedRow(grid_t* grid, int playerIdx);
+static void deleteFovCache(fovCache_t* cache);
+static bool setLightSpan(grid_t* grid, int radius);
+static void renderRemembered(grid_t* grid, uint64_t seenBits, int word, char* buffer);
+static int lightHalfWidth(grid_t* grid, int rowDist);
+static bool inLight(grid_t* grid, int playerIdx, int idx);
+static uint64_t litBits(grid_t* grid, int playerIdx, int word, uint64_t bits);
+static void litWords(grid_t* grid, int playerIdx, int* firstWord, int* lastWord);
+static lineVerdict_t prepareLine(grid_t* grid, int mapPointIdx, int playerIdx, rayWalk_t* walk);
+static bool walkRay(grid_t* grid, rayWalk_t* walk);
+static unsigned walkRaysScalar(grid_t* grid, rayWalk_t* walks, int numRays);
+#ifdef HAVE_X86_SIMD
+static unsigned walkRaysAVX2(grid_t* grid, rayWalk_t* walks, int numRays);
+#endif
+static rayTemplate_t* getRayTemplate(int rowDist, int colDist);
+static bool growRayTemplates(int rows, int columns);
+static long getTemplateBytes(void);
+static rayTemplate_t* buildRayTemplate(int rowDist, int colDist);
+static void freeRayTemplates(void);
+static bool blocksSight(char gridChar);
+static char* mapFile(const char* mapFilePath, int* mapLength);
+static bool measureMap(const char* map, int mapLength, int* numRows, int* numColumns, bool* evenRows);
+static char* padMap(const char* map, int mapLength, int numRows, int numColumns);
+static void releaseMap(char* map, int mapLength, bool padded);
+static bool packOriginal(grid_t* grid, const char* mapString);
+static char originalAt(grid_t* grid, int idx);
+static void unpackOriginal(grid_t* grid, int firstIdx, int numCells, char* buffer);
+static void buildOpacity(grid_t* grid);
+static void buildPassageDegree(grid_t* grid);
+static int countPassageNeighbors(grid_t* grid, int idx);
+static long opacityWord(grid_t* grid, int row, int col);
+static bool isOpaque(grid_t* grid, int row, int col);
+static bool anyOpaque(grid_t* grid, int row, int firstCol, int lastCol);
+
+/************** visibility engines ***********/
+// Fastest first: a row of the full table, a compressed row decoded, a cached row, and a row cast every time
+static const visEngine_t tableEngine = {"table", buildVisTable, getTableRow, tableCanSee};
+static const visEngine_t runEngine = {"runs", buildVisRuns, getRunRow, runsCanSee};
+static const visEngine_t cacheEngine = {"cache", startCache, getCacheRow, castCanSee};
+static const visEngine_t rayEngine = {"rays", startRays, castRow, castCanSee};
+static const visEngine_t* const visEngines[] = {&tableEngine, &runEngine, &cacheEngine, &rayEngine};
+
 /************** global functions ***********/
 
 /*************** grid_initialize() *************/
@@ -42,58 +289,101 @@ typedef struct grid {
 grid_t*
 grid_initialize(char* mapFilePath, int goldMinNumPiles, int goldMaxNumPiles, int* numPilesPoint)
 {
-  // Read and store contents of map file to be used for a grid
-  FILE* mapFile = fopen(mapFilePath, "r");
-  if (mapFile == NULL) {
+  // Map the file in and check its shape, then build the grid straight from it
+  if (mapFilePath == NULL) {
     return NULL;  // invalid map file path
   }
-  int currNR = file_numLines(mapFile);  // num rows = number of lines in file
-
-  char* firstLine = file_readLine(mapFile);
-  int currNC = strlen(firstLine) + 1;   // num columns = number of characters, including newline, in first line
-
-  char* currGrid = malloc(currNC * currNR + 1);
-  char* restOfFile = file_readFile(mapFile);
-
-  currGrid = strcpy(currGrid, firstLine); 
-  free(firstLine);
-  currGrid = strcat(currGrid, "\n");
-
-  if (firstLine == NULL || restOfFile == NULL) {
-    return NULL;  // invalid contents of map file path
+  int mapLength;
+  char* map = mapFile(mapFilePath, &mapLength);
+  if (map == NULL) {
+    return NULL;  // invalid map file path
+  }
+  int currNR, currNC;
+  bool evenRows;
+  if (!measureMap(map, mapLength, &currNR, &currNC, &evenRows)) {
+    fprintf(stderr, "grid_initialize: %s isn't a map: it has no columns, or too many cells\n", mapFilePath);
+    munmap(map, mapLength);
+    return NULL;
+  }
+  bool padded = !evenRows;  // short rows are padded with rock out to the widest, in a copy of the map
+  if (padded) {
+    char* paddedMap = padMap(map, mapLength, currNR, currNC);
+    munmap(map, mapLength);
+    if (paddedMap == NULL) {
+      fprintf(stderr, "grid_initialize: error allocating memory for padded map\n");
+      return NULL;
+    }
+    map = paddedMap;
+    mapLength = currNR * currNC;
   }
-
-  currGrid = strcat(currGrid, restOfFile);  // concatanate all of file's contents to be used as the map
-  free(restOfFile);
-
 
   // Allocate memory for grid and contained pointers
-  grid_t* grid = malloc(sizeof(int) + sizeof(int) + sizeof(grid->masterGrid) + sizeof(grid->originalGrid));
-  grid->masterGrid = malloc(strlen(currGrid) + 1);    // string with current game-state information
-  grid->originalGrid = malloc(strlen(currGrid) + 1);  // string with original map file, no gold, players, etc.
+  grid_t* grid = calloc(1, sizeof(grid_t));  // zeroed, so grid_delete can clean up after a failure part way
+  if (grid == NULL) {
+    fprintf(stderr, "grid_initialize: error allocating memory for grid\n");
+    releaseMap(map, mapLength, padded);
+    return NULL;
+  }
+  numLiveGrids++;  // counted once it exists, as grid_delete uncounts it
+  grid->masterGrid = malloc(mapLength + 1);    // string with current game-state information
 
   // Store all variables with completed information in grid pointers
   grid->numRows = currNR;
   grid->numColumns = currNC;
-  strcpy(grid->originalGrid, currGrid);
+  grid->gridLength = mapLength;  // num rows * num columns, less a newline if the last row's missing one
+  if (grid->masterGrid == NULL || !packOriginal(grid, map)) {  // original map file, no gold, players, etc.
+    grid_delete(grid);
+    releaseMap(map, mapLength, padded);
+    return NULL;
+  }
+  memcpy(grid->masterGrid, map, mapLength);
+  grid->masterGrid[mapLength] = '\0';
+  releaseMap(map, mapLength, padded);
+
+  // Visibility only depends on the terrain, so classify each character once and then compute it for every spot a player can stand on
+  grid->gridWords = (currNC * currNR + 63) / 64;
+  if (!setLightSpan(grid, loadLightRadius)) {  // tables are built for it, so nothing beyond it is cast
+    grid_delete(grid);
+    return NULL;
+  }
+  if (walkRays == NULL) {
+    grid_setVectorRays(true);  // widest kernel this CPU supports, picked before any worker threads need it
+  }
+  struct timespec buildStart, buildEnd;
+  clock_gettime(CLOCK_MONOTONIC, &buildStart);
+  buildOpacity(grid);
+  buildPassageDegree(grid);
+  buildRegions(grid);
+  grid->cullRooms = roomCulling && grid->regionOf != NULL;
+  pickEngine(grid);
+  grid->builtRadius = (grid->visTable != NULL || grid->visRuns != NULL) ? grid->lightRadius : 0;
+  clock_gettime(CLOCK_MONOTONIC, &buildEnd);
+  grid->buildSeconds = (buildEnd.tv_sec - buildStart.tv_sec) + (buildEnd.tv_nsec - buildStart.tv_nsec) / 1e9;
 
   // Randomly generate number of piles given the parameter constraints, apply to master grid
   int numPiles = rand() % (goldMaxNumPiles - goldMinNumPiles + 1) + goldMinNumPiles;
   *numPilesPoint = numPiles;
 
   for (int i = 0; i < numPiles; i++) {
-    // Add gold to curr grid for saving in masterGrid -- original shouldn't have gold allocated
+    // Add gold to the master grid only -- original shouldn't have gold allocated
     int totalIndices = currNC * currNR;
     int location = rand() % totalIndices;
-    while (currGrid[location] != RoomSpot) {
+    while (grid->masterGrid[location] != RoomSpot) {
       location = rand() % totalIndices;
     }
-    currGrid[location] = GoldSpot;
+    grid->masterGrid[location] = GoldSpot;
   }
 
-  strcpy(grid->masterGrid, currGrid);  // now master grid updated with gold, store in grid
-  free(currGrid);
-  fclose(mapFile);
+  if (!buildPileIndex(grid, numPiles)) {
+    fprintf(stderr, "grid_initialize: error allocating gold pile index\n");
+    grid_delete(grid);
+    return NULL;
+  }
+  if (!startChangeLog(grid)) {
+    fprintf(stderr, "grid_initialize: error allocating change log\n");
+    grid_delete(grid);
+    return NULL;
+  }
 
   return grid;  // return pointer to completed grid
 }
@@ -103,11 +393,11 @@ grid_initialize(char* mapFilePath, int goldMinNumPiles, int goldMaxNumPiles, int
 bool
 grid_updateMaster(grid_t* grid, int idx, char addedChar) 
 {
-  if (grid == NULL || idx > (grid->numColumns * grid->numRows) || idx < 0) {
+  if (grid == NULL || idx >= grid->gridLength || idx < 0) {
     return false; // invalid parameter(s)
   }
   if (addedChar == OrigCharIndicator) {
-    grid->masterGrid[idx] = grid->originalGrid[idx];  // Swap character from master grid with one from original map file when asked using indicator
+    setMasterChar(grid, idx, originalAt(grid, idx));  // Swap character from master grid with one from original map file when asked using indicator
   }
   // Check all other possible characters according to specs -- if no overlap, return false
   if (addedChar != GoldSpot && addedChar != MyPlayer 
@@ -117,23 +407,77 @@ grid_updateMaster(grid_t* grid, int idx, char addedChar)
   }
 
   // Valid character and parameters provided, update character at index and return true for success
-  grid->masterGrid[idx] = addedChar;
+  setMasterChar(grid, idx, addedChar);
   return true;
 }
 
+/*************** grid_getVersion() *************/
+/* see grid.h for description */
+long
+grid_getVersion(grid_t* grid)
+{
+  if (grid == NULL) {
+    return -1;
+  }
+  return grid->version;
+}
+
+/*************** grid_getChangesSince() *************/
+/* see grid.h for description */
+int
+grid_getChangesSince(grid_t* grid, long version, int* changedIdxs, int maxIdxs)
+{
+  if (grid == NULL || version < 0 || version > grid->version || (changedIdxs == NULL && maxIdxs > 0) || maxIdxs < 0) {
+    return -1;  // invalid parameter(s)
+  }
+  if (grid->version - version > ChangeLogSize) {
+    return -1;  // some of those changes have already left the log
+  }
+  // Newest first, marking each index the first time it's seen so it's only counted once
+  int numChanged = 0;
+  for (long v = grid->version; v > version; v--) {
+    int idx = grid->changeLog[(v - 1) % ChangeLogSize];
+    uint64_t bit = (uint64_t)1 << (idx % 64);
+    if ((grid->changeMarks[idx / 64] & bit) == 0) {
+      grid->changeMarks[idx / 64] |= bit;
+      if (numChanged < maxIdxs) {
+        changedIdxs[numChanged] = idx;
+      }
+      numChanged++;
+    }
+  }
+  for (long v = grid->version; v > version; v--) {
+    int idx = grid->changeLog[(v - 1) % ChangeLogSize];
+    grid->changeMarks[idx / 64] &= ~((uint64_t)1 << (idx % 64));
+  }
+  return numChanged;
+}
+
+/*************** grid_rowChangedSince() *************/
+/* see grid.h for description */
+bool
+grid_rowChangedSince(grid_t* grid, int row, long version)
+{
+  if (grid == NULL || row < 0 || row >= grid->numRows) {
+    return false;  // invalid parameter(s)
+  }
+  return grid->rowVersion[row] > version;
+}
+
 /*************** grid_getVisible() *************/
 /* see grid.h for description */
 char*
 grid_getVisible(grid_t* grid, int playerIdx)
 {
-  if (grid == NULL || playerIdx < 0 || playerIdx > grid->numColumns*grid->numRows) {
-    return NULL;  // invalid parameter(s)
+  if (grid == NULL || playerIdx < 0 || playerIdx >= grid->gridLength) {
+    return NULL;  // invalid parameter(s), including the spot of a missing final newline
   }
 
   // Create and initialize new grid to contain player's visible grid
-  char* visibleGrid = malloc(strlen(grid->masterGrid) + 1);
+  int gridLength = grid->gridLength;
+  char* visibleGrid = malloc(gridLength + 1);
   if (visibleGrid != NULL) {
-    for (int i = 0; i < strlen(grid->masterGrid); i++) {
+    for (int i = 0; i < gridLength; i++) {
       if (i % grid->numColumns == grid->numColumns - 1) {
         visibleGrid[i] = '\n';  // since grid strings contain newlines, add at the end of every row
       }
@@ -141,14 +485,28 @@ grid_getVisible(grid_t* grid, int playerIdx)
         visibleGrid[i] = Rock;  // otherwise initialize with whitespace, a rock
       }
     }
-    // Iterate over all characters, using helper to determine visibility
-    for (int i = 0; i < grid->numRows * grid->numColumns; i++) {
-      if (grid_isVisiblePoint(grid, i, playerIdx)) {
-        visibleGrid[i] = grid->masterGrid[i]; // if visible, update visible grid with character of master
+    bool isCast;
+    uint64_t* visRow = getVisibleRow(grid, playerIdx, &isCast);
+    if (visRow == NULL) {
+      free(visibleGrid);
+      return NULL;
+    }
+    // Scan the player's visibility bitset, copying each visible character of master
+    int firstWord, lastWord;
+    litWords(grid, playerIdx, &firstWord, &lastWord);
+    for (int w = firstWord; w <= lastWord; w++) {
+      uint64_t bits = litBits(grid, playerIdx, w, visRow[w]);
+      while (bits != 0) {
+        int i = w * 64 + __builtin_ctzll(bits);
+        visibleGrid[i] = grid->masterGrid[i];
+        bits &= bits - 1;  // clear lowest set bit
       }
-    } 
+    }
+    if (isCast) {
+      free(visRow);
+    }
     visibleGrid[playerIdx] = MyPlayer;
-    visibleGrid[strlen(grid->masterGrid)]= '\0';
+    visibleGrid[gridLength]= '\0';
     return visibleGrid;
   }
 
@@ -162,9 +520,28 @@ bool
 grid_isVisiblePoint(grid_t* grid, int mapPointIdx, int playerIdx)
 {
   // Check validity of grid and range of indices for each provided index, ensuring within grid limits
-  if (grid == NULL || playerIdx < 0 || playerIdx > grid->numColumns*grid->numRows  || mapPointIdx < 0 || mapPointIdx > grid->numColumns*grid->numRows) {
+  if (grid == NULL || playerIdx < 0 || playerIdx >= grid->numColumns*grid->numRows  || mapPointIdx < 0 || mapPointIdx >= grid->numColumns*grid->numRows) {
     return false; // invalid parameters
   }
+  rayWalk_t walk;
+  lineVerdict_t verdict = prepareLine(grid, mapPointIdx, playerIdx, &walk);
+  return verdict == LineClear || (verdict == LineToWalk && walkRay(grid, &walk));
+}
+
+/*************** prepareLine() *************/
+/* Decide whatever can be decided about the line of sight from playerIdx to
+ * mapPointIdx without walking it: the light radius, passages, rectangular
+ * rooms, and lines along a single row (tested a word at a time). Otherwise
+ * fill in walk with the ray template to check, starting from whichever point
+ * is lower on the grid (the map point if they share a row), and return
+ * LineToWalk. A template that can't be built blocks the line.
+ */
+static lineVerdict_t
+prepareLine(grid_t* grid, int mapPointIdx, int playerIdx, rayWalk_t* walk)
+{
+  if (!inLight(grid, playerIdx, mapPointIdx)) {
+    return LineBlocked;  // beyond the light radius
+  }
 
   int mc = (int)(mapPointIdx % grid->numColumns); // map column index in 2D representation
   int mr = (int)(mapPointIdx / grid->numColumns); // map row index in 2D representation
@@ -172,98 +549,316 @@ grid_isVisiblePoint(grid_t* grid, int mapPointIdx, int playerIdx)
   int pr = (int)(playerIdx / grid->numColumns); // player row index in 2D representation
 
   // If current character is part of a passage, check if visible - only one extended character in passage is visible at a time
-  if (grid->masterGrid[mapPointIdx] == Passage) {
+  // Only the terrain blocks sight, so all checks read the original grid (players standing in a passage don't make it transparent)
+  if (originalAt(grid, mapPointIdx) == Passage) {
     if (!grid_checkForVisiblePassage(grid, mapPointIdx, mr, pr, mc, pc)) {
-      return false;
+      return LineBlocked;
     }
   }
 
-  // set default starting and ending (x,y) for moving through the grid to validate visibility 
-  float startY = mr;
-  float startX = mc;
-  float endY = pr;
-  float endX = pc;
-
-  // flip starting and ending (x,y) if necessary  
-  if (pr > mr) {
-    startY = (float)pr;
-    startX = (float)pc;
-    endY = (float)mr;
-    endX = (float)mc;
+  // Nothing inside a rectangular room can block a line between two of its spots
+  if (grid->regionOf != NULL && mapPointIdx < grid->numColumns*grid->numRows && playerIdx < grid->numColumns*grid->numRows) {
+    int region = grid->regionOf[playerIdx];
+    if (region >= 0 && region == grid->regionOf[mapPointIdx] && grid->regions[region].isRect) {
+      return LineClear;
+    }
   }
 
-  // Set the x and y step for moving character by character in grid string to determine visibility
-  float xinc;  // Increment in x-direction (i.e. across a row)
-  float yinc = 0.; // Increment in x-direction (i.e. across a column)
-  if (startX - endX != 0.){
-    float numerator = (float)abs(startY - endY);
-    float denominator = (float)abs(startX - endX);  // no divide by zero error
-    yinc = -1*(float)numerator/denominator;   // since starting y is always the lower coordinate, and row number is in ascending order, make yinc negative
+  int startRow = (pr > mr) ? pr : mr;
+  int startCol = (pr > mr) ? pc : mc;
+  int endRow = (pr > mr) ? mr : pr;
+  int endCol = (pr > mr) ? mc : pc;
+  if (startRow == endRow) {
+    // Along a single row, every character strictly between the points blocks; test them a word at a time
+    int firstCol = (startCol < endCol) ? startCol : endCol;
+    int lastCol = (startCol < endCol) ? endCol : startCol;
+    return anyOpaque(grid, startRow, firstCol + 1, lastCol - 1) ? LineBlocked : LineClear;
+  }
+  walk->ray = getRayTemplate(startRow - endRow, abs(endCol - startCol));
+  if (walk->ray == NULL) {
+    return LineBlocked;  // error building template
+  }
+  walk->startRow = startRow;
+  walk->startCol = startCol;
+  walk->colStep = (endCol > startCol) ? 1 : -1;  // templates are built moving right, mirror them when moving left
+  return LineToWalk;
+}
 
-    if (startX > endX) {
-      xinc = -1.; // move left across a row
+/*************** walkRay() *************/
+/* Check a line of sight left by prepareLine against its ray template,
+ * returning true if none of its characters, or pairs of characters, block it.
+ * The characters to check only depend on the offset between the points, so
+ * this is just a loop over the template.
+ */
+static bool
+walkRay(grid_t* grid, rayWalk_t* walk)
+{
+  rayTemplate_t* ray = walk->ray;
+  for (int i = 0; i < ray->numChecks; i++) {
+    rayCheck_t* check = &ray->checks[i];
+    if (isOpaque(grid, walk->startRow - check->row, walk->startCol + check->col * walk->colStep)
+        && isOpaque(grid, walk->startRow - check->pairRow, walk->startCol + check->pairCol * walk->colStep)) {
+      return false;
     }
-    else {
-      xinc = 1.;  // move right across a row
+  }
+  return true;  // if nothing else returned, visibility isn't blocked
+}
+
+/*************** walkRaysScalar() *************/
+/* Walk each of numRays lines of sight in turn, returning a bitmask with bit i
+ * set if walks[i] is clear. Used on CPUs without AVX2, and when vector rays
+ * are turned off.
+ */
+static unsigned
+walkRaysScalar(grid_t* grid, rayWalk_t* walks, int numRays)
+{
+  unsigned clear = 0;
+  for (int i = 0; i < numRays; i++) {
+    if (walkRay(grid, &walks[i])) {
+      clear |= 1u << i;
     }
   }
-  else {
-    // move up in a column
-    xinc = 0.;
-    yinc = -1.;
-  }
-
-  // Begin the process of moving from a starting coordinate to ending coordinate, checking intersected point(s) along the way
-  // If intersection occurs through a wall's coordinate or between, the points will not be visible to one another
-  float currY = startY;
-  float priorY = startY;
-  for (int currX = startX + xinc; (currX-endX) != 0 || (currY-endY) > ErrorMargin; currX += xinc) {   // continue incrementing through list until end point is reached
-    currY += yinc;
-    // Two points in the grid can be intersected in the vertical direction; see if the 'top' character is a barrier of some sort
-    char topChar = grid->masterGrid[(((int)(currY))*grid->numColumns) + currX]; // row*number of items in row + column = current position - casting to int moves current coordinate UP
-    if (topChar == HorBdry || topChar == Rock || topChar == Corner || topChar == VerBdry || topChar == Passage) {  // visibility-blocking character
-      if ((int)currY != currY) {  // true when line connecting two points splits between coordinates on the grid
-        char bottomChar = grid->masterGrid[(((int)(currY))*grid->numColumns) + currX + grid->numColumns];
-        // In this case, check the 'lower' character in the grid - if it is also a barrier of some sort, gridpoints are not visible
-        if (bottomChar == HorBdry || bottomChar == Rock || bottomChar == Corner || bottomChar == VerBdry || bottomChar == Passage) {  // visibility-blocking character
-          if (!(currY-endY < ErrorMargin) || currX != endX) {   // if we haven't reached our destination (according to some small error margin)
-            return false; // not visible
-          }
-        }
+  return clear;
+}
+
+#ifdef HAVE_X86_SIMD
+/*************** walkRaysAVX2() *************/
+/* walkRaysScalar 8 checks at a time: each line of sight's template is read
+ * 8 checks per step with masked loads (so nothing past its end is touched),
+ * the rows and columns of both cells of every check are computed side by
+ * side, and their opacity bits are gathered from the bitmap read as 32-bit
+ * words (x86 is little-endian, so column col of 64-bit word w is bit col % 32
+ * of 32-bit word 2w + col / 32 % 2). A line
+ * is blocked as soon as both characters of any check are. Whether a line is
+ * clear doesn't depend on the order its checks are made in, so this gives
+ * exactly walkRay's answers.
+ */
+__attribute__((target("avx2")))
+static unsigned
+walkRaysAVX2(grid_t* grid, rayWalk_t* walks, int numRays)
+{
+  if (grid->opacity == NULL) {
+    return walkRaysScalar(grid, walks, numRays);  // nothing to gather from
+  }
+  const int* opacityWords = (const int*)grid->opacity;
+  bool tiled = grid->opacityTileShift != 0;
+  __m256i columnWords = _mm256_set1_epi32(grid->opacityColumnWords);
+  __m256i rowWords = _mm256_set1_epi32(2 * grid->opacityColumnWords);  // 32-bit words in each row, laid out row by row
+  __m256i tileRows = _mm256_set1_epi32((1 << OpacityTileShift) - 1);
+  __m256i lowHalf = _mm256_set1_epi32(0xFFFF);
+  __m256i bitInWord = _mm256_set1_epi32(31);
+  __m256i one = _mm256_set1_epi32(1);
+  __m256i evensThenOdds = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+  __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256i firstLanes = _mm256_setr_epi64x(0, 1, 2, 3);
+  __m256i lastLanes = _mm256_setr_epi64x(4, 5, 6, 7);
+
+  unsigned clear = 0;
+  for (int r = 0; r < numRays; r++) {
+    rayTemplate_t* ray = walks[r].ray;
+    __m256i startRow = _mm256_set1_epi32(walks[r].startRow);
+    __m256i startCol = _mm256_set1_epi32(walks[r].startCol);
+    __m256i step = _mm256_set1_epi32(walks[r].colStep);
+    bool blocked = false;
+    for (int i = 0; i < ray->numChecks && !blocked; i += 8) {
+      // The next 8 checks as 4 shorts each, split into (row, col) and (pairRow, pairCol) halves
+      int remaining = ray->numChecks - i;
+      const long long* checks = (const long long*)&ray->checks[i];
+      __m256i firstFour = _mm256_maskload_epi64(checks, _mm256_cmpgt_epi64(_mm256_set1_epi64x(remaining), firstLanes));
+      __m256i lastFour = _mm256_maskload_epi64(checks + 4, _mm256_cmpgt_epi64(_mm256_set1_epi64x(remaining), lastLanes));
+      firstFour = _mm256_permutevar8x32_epi32(firstFour, evensThenOdds);
+      lastFour = _mm256_permutevar8x32_epi32(lastFour, evensThenOdds);
+      __m256i cells = _mm256_permute2x128_si256(firstFour, lastFour, 0x20);  // row | col << 16 of every check
+      __m256i pairs = _mm256_permute2x128_si256(firstFour, lastFour, 0x31);  // pairRow | pairCol << 16
+      __m256i active = _mm256_cmpgt_epi32(_mm256_set1_epi32(remaining), lanes);
+
+      __m256i cellRow = _mm256_sub_epi32(startRow, _mm256_and_si256(cells, lowHalf));
+      __m256i cellCol = _mm256_add_epi32(startCol, _mm256_sign_epi32(_mm256_srli_epi32(cells, 16), step));
+      __m256i pairRow = _mm256_sub_epi32(startRow, _mm256_and_si256(pairs, lowHalf));
+      __m256i pairCol = _mm256_add_epi32(startCol, _mm256_sign_epi32(_mm256_srli_epi32(pairs, 16), step));
+      // The 32-bit word holding each cell: see opacityWord, with one more bit for the column's half of its 64-bit word
+      __m256i cellAt, pairAt;
+      if (tiled) {
+        cellAt = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(cellRow, 3), columnWords), _mm256_srli_epi32(cellCol, 6));
+        pairAt = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(pairRow, 3), columnWords), _mm256_srli_epi32(pairCol, 6));
+        cellAt = _mm256_or_si256(_mm256_slli_epi32(_mm256_or_si256(_mm256_slli_epi32(cellAt, 3), _mm256_and_si256(cellRow, tileRows)), 1),
+                                 _mm256_and_si256(_mm256_srli_epi32(cellCol, 5), one));
+        pairAt = _mm256_or_si256(_mm256_slli_epi32(_mm256_or_si256(_mm256_slli_epi32(pairAt, 3), _mm256_and_si256(pairRow, tileRows)), 1),
+                                 _mm256_and_si256(_mm256_srli_epi32(pairCol, 5), one));
       }
-      else {  // line directly intersects with a coordinate that's a barrier of some sort
-        if (!(currY-endY < ErrorMargin) || currX != endX) {  // if we haven't reached our destination (according to some small error margin)
-          return false; // not visible
-        }
+      else {
+        cellAt = _mm256_add_epi32(_mm256_mullo_epi32(cellRow, rowWords), _mm256_srli_epi32(cellCol, 5));
+        pairAt = _mm256_add_epi32(_mm256_mullo_epi32(pairRow, rowWords), _mm256_srli_epi32(pairCol, 5));
       }
+      __m256i cellWord = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), opacityWords, cellAt, active, 4);
+      __m256i pairWord = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), opacityWords, pairAt, active, 4);
+      __m256i cellOpaque = _mm256_srlv_epi32(cellWord, _mm256_and_si256(cellCol, bitInWord));
+      __m256i pairOpaque = _mm256_srlv_epi32(pairWord, _mm256_and_si256(pairCol, bitInWord));
+      __m256i bothOpaque = _mm256_and_si256(_mm256_and_si256(cellOpaque, pairOpaque), one);
+      blocked = !_mm256_testz_si256(bothOpaque, bothOpaque);
     }
-    
-    // Line connecting two points to determine visibility can also fall between two gridpoints in the x-direction
-    // If this is the case, visibility is interrupted if both the left and right coordinate is a barrier
-    int rowDiff = (int)priorY - (int)currY;  // number of gridpoints intersected in this step (i.e. steep slope)
-    // For every row intersected, check left & right gridpoint and determine if barrier
-    for (int i = 1; i <= rowDiff; i++) {
-      int rightIndex = (((int)currY)*grid->numColumns) + currX + grid->numColumns*i; 
-      char rightChar = grid->masterGrid[rightIndex]; // character to the right of the split for the current step in the row intersected
-      if (rightChar == HorBdry || rightChar == Corner || rightChar == VerBdry || rightChar == Rock || rightChar == Passage) {   // visibility-blocking character
-        int leftIndex = (((int)currY)*grid->numColumns) + currX + grid->numColumns*i - xinc; 
-        char leftChar = grid->masterGrid[leftIndex];  // character to the left of the split for the current step in the row intersected
-        if (leftChar == HorBdry || leftChar == Rock || leftChar == Corner || leftChar == VerBdry || leftChar == Passage) {  // visibility-blocking character
-          
-          bool reachedYDest = ((int)(((((int)currY)*grid->numColumns) + grid->numColumns*i)/grid->numColumns) - endY < ErrorMargin); // has this iteration reached target y -- current iteration's row position - ending row < rounding error
-          bool notStartChar = leftIndex != startX+startY*grid->numColumns && rightIndex != startX+startY*grid->numColumns;  // same index as where we started?
-          if ((!reachedYDest || currX != endX) && notStartChar) { // if we haven't reached destination and have a new character, then the visibility is blocked
-            return false; // not visible
-          }
-        }
+    if (!blocked) {
+      clear |= 1u << r;
+    }
+  }
+  return clear;
+}
+#endif
+
+/*************** getRayTemplate() *************/
+/* Return the shared ray template for a line rowDist rows up and colDist
+ * columns right of its start, building it (and growing the table) on first use.
+ * Several threads may look templates up at once while a visibility table is
+ * built, as long as the table already covers the grid (see buildVisTable):
+ * a missing template is then built under templateLock, and published with a
+ * release store so other threads only ever see it complete.
+ * Returns NULL on memory allocation error.
+ */
+static rayTemplate_t*
+getRayTemplate(int rowDist, int colDist)
+{
+  if (rowDist >= templateRows || colDist >= templateColumns) {
+    // Grow the table to cover this offset, keeping templates already built
+    if (!growRayTemplates((rowDist >= templateRows) ? rowDist + 1 : templateRows,
+                          (colDist >= templateColumns) ? colDist + 1 : templateColumns)) {
+      return NULL;
+    }
+  }
+  rayTemplate_t** slot = &rayTemplates[rowDist * templateColumns + colDist];
+  rayTemplate_t* ray = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+  if (ray == NULL) {
+    pthread_mutex_lock(&templateLock);
+    ray = *slot;  // another thread may have built it while we waited
+    if (ray == NULL) {
+      ray = buildRayTemplate(rowDist, colDist);
+      if (ray != NULL) {
+        templateBytes += sizeof(rayTemplate_t) + (rowDist + colDist + 1) * sizeof(rayCheck_t);
       }
+      __atomic_store_n(slot, ray, __ATOMIC_RELEASE);
     }
-    if (currY-endY < ErrorMargin && currX == endX) {   // have we reached destination, protecting from rounding errors
-      return true;
+    pthread_mutex_unlock(&templateLock);
+  }
+  return ray;
+}
+
+/*************** growRayTemplates() *************/
+/* Grow the shared template table to cover rows x columns offsets, keeping
+ * templates already built. Not safe while other threads use the table.
+ * Returns false on memory allocation error.
+ */
+static bool
+growRayTemplates(int rows, int columns)
+{
+  if (rows <= templateRows && columns <= templateColumns) {
+    return true;  // already big enough
+  }
+  int newRows = (rows > templateRows) ? rows : templateRows;
+  int newColumns = (columns > templateColumns) ? columns : templateColumns;
+  rayTemplate_t** newTemplates = calloc(newRows * newColumns, sizeof(rayTemplate_t*));
+  if (newTemplates == NULL) {
+    fprintf(stderr, "growRayTemplates: error allocating memory for template table\n");
+    return false;
+  }
+  for (int r = 0; r < templateRows; r++) {
+    for (int c = 0; c < templateColumns; c++) {
+      newTemplates[r * newColumns + c] = rayTemplates[r * templateColumns + c];
     }
-    priorY = currY;
   }
-  return true;  // if nothing else returned, visibility isn't blocked
+  free(rayTemplates);
+  templateBytes += ((long)newRows * newColumns - (long)templateRows * templateColumns) * sizeof(rayTemplate_t*);
+  rayTemplates = newTemplates;
+  templateRows = newRows;
+  templateColumns = newColumns;
+  return true;
+}
+
+/*************** getTemplateBytes() *************/
+/* Return the memory the ray templates take so far: rayTemplates, and every
+ * template built into it. Workers on any grid may be adding to it.
+ */
+static long
+getTemplateBytes(void)
+{
+  pthread_mutex_lock(&templateLock);
+  long bytes = templateBytes;
+  pthread_mutex_unlock(&templateLock);
+  return bytes;
+}
+
+/*************** buildRayTemplate() *************/
+/* Walk the line from (0, 0) to rowDist rows up and colDist columns right,
+ * recording every character, or pair of characters, that would block it.
+ * 
+ * Going straight up a column, every character strictly between the endpoints
+ * blocks. Otherwise the line is walked one column at a time. After k of
+ * colDist columns it has risen k*rowDist/colDist rows, kept exactly as a whole
+ * number of rows plus a remainder in units of 1/colDist, so no floating point
+ * rounding is involved. At each column (but the last) the line either lands
+ * exactly on a character, which blocks it, or passes between two vertically
+ * adjacent characters, which only blocks it if both do. Every row boundary the
+ * line crossed since the last column likewise blocks it only if the characters
+ * either side of the crossing (this column and the previous one) both block,
+ * except for the crossing right beside the starting point.
+ */
+static rayTemplate_t*
+buildRayTemplate(int rowDist, int colDist)
+{
+  // A line checks at most one character or pair per column, plus one pair per row crossed
+  rayTemplate_t* ray = malloc(sizeof(rayTemplate_t) + (rowDist + colDist + 1) * sizeof(rayCheck_t));
+  if (ray == NULL) {
+    fprintf(stderr, "buildRayTemplate: error allocating memory for ray template\n");
+    return NULL;
+  }
+  ray->numChecks = 0;
+
+  if (colDist == 0) {
+    for (int row = 1; row < rowDist; row++) {
+      ray->checks[ray->numChecks++] = (rayCheck_t){row, 0, row, 0};
+    }
+    return ray;
+  }
+
+  int wholeRise = rowDist / colDist;  // whole rows risen per column
+  int partRise = rowDist % colDist;  // plus this many 1/colDist of a row
+  int risen = 0;  // whole rows risen so far
+  int remainder = 0;  // fraction of a row risen so far, in units of 1/colDist
+  int priorRise = 0;  // rows above the start of the character at or just below the line in the prior column
+  for (int step = 1; step <= colDist; step++) {
+    risen += wholeRise;
+    remainder += partRise;
+    if (remainder >= colDist) {
+      remainder -= colDist;
+      risen++;
+    }
+    // Character at or just above the line in this column, and the one below it if the line passes between them
+    int topRise = (remainder == 0) ? risen : risen + 1;
+    if (step < colDist) {
+      ray->checks[ray->numChecks++] = (rayCheck_t){topRise, step, (remainder == 0) ? topRise : topRise - 1, step};
+    }
+    // For every row crossed in this step, the characters to the left and right of the crossing
+    for (int rise = topRise - 1; rise >= priorRise; rise--) {
+      if (step > 1 || rise > 0) {  // the crossing beside the starting point doesn't count
+        ray->checks[ray->numChecks++] = (rayCheck_t){rise, step, rise, step - 1};
+      }
+    }
+    priorRise = topRise;
+  }
+  return ray;
+}
+
+/*************** freeRayTemplates() *************/
+/* Free the shared ray template table and every template in it. */
+static void
+freeRayTemplates(void)
+{
+  for (int i = 0; i < templateRows * templateColumns; i++) {
+    free(rayTemplates[i]);
+  }
+  free(rayTemplates);
+  rayTemplates = NULL;
+  templateRows = 0;
+  templateColumns = 0;
+  templateBytes = 0;
 }
 
 /*************** grid_checkForVisiblePassage() *************/
@@ -271,27 +866,15 @@ grid_isVisiblePoint(grid_t* grid, int mapPointIdx, int playerIdx)
 bool
 grid_checkForVisiblePassage(grid_t* grid, int mapPointIdx, int mr, int pr, int mc, int pc)
 {
-  if (grid->masterGrid[mapPointIdx] == Passage) {   // error check 
-    if (abs(mr - pr) > 1 || abs(mc - pc) > 1) {  // only passages further than one character away are potentially invisible
-      char* mGrid = grid->masterGrid;
-      int numColumns = grid->numColumns;
-      int numAdjacentPassage = 0;   
-      // Check for passage characters up/down/left/right
-      if (mGrid[mapPointIdx - 1] == Passage) {
-        numAdjacentPassage += 1;
-      }
-      if (mGrid[mapPointIdx + 1] == Passage) {
-        numAdjacentPassage += 1;
-      }
-      if (mGrid[mapPointIdx + numColumns] == Passage) {
-        numAdjacentPassage += 1;
-      }
-      if (mGrid[mapPointIdx - numColumns] == Passage) {
-        numAdjacentPassage += 1;
-      }
-      if (numAdjacentPassage > 1) { // any passage distanced from character is only visible if only one neighboring passage character
-        return false;
-      }
+  if (grid == NULL || mapPointIdx < 0 || mapPointIdx >= grid->numColumns * grid->numRows) {
+    return true;  // invalid parameter(s), not a blocked passage
+  }
+  if (abs(mr - pr) > 1 || abs(mc - pc) > 1) {  // only passages further than one character away are potentially invisible
+    // Non-passages have degree 0; the table is only missing if it couldn't be allocated
+    int numAdjacentPassage = (grid->passageDegree != NULL) ? grid->passageDegree[mapPointIdx]
+                                                           : countPassageNeighbors(grid, mapPointIdx);
+    if (numAdjacentPassage > 1) { // any passage distanced from character is only visible if only one neighboring passage character
+      return false;
     }
   }
   return true;  // either visible hallway or wrong character entered, either way not blocked passage
@@ -305,105 +888,2140 @@ grid_updatePlayerGrid(grid_t* grid, player_t* player)
   if (grid == NULL || player == NULL) {
     return NULL;  // invalid parameter
   }
-  // Get player's current known grid
-  char* knownGrid = player_getGrid(player);
-  char* newGrid = grid_getVisible(grid, player_getLoc(player)); // get visible grid based on new player coordinates
-  // if either grid is null, at least return what's currently accessible
-  if (knownGrid == NULL) {
-    return newGrid;
+  char* playerGrid = malloc(grid->gridLength + 1);
+  if (playerGrid == NULL) {
+    fprintf(stderr, "grid_updatePlayerGrid: error allocating memory for player grid\n");
+    return NULL;
   }
-  if (newGrid == NULL) {
-    return knownGrid;
+  if (!grid_renderPlayerGrid(grid, player, playerGrid, grid->gridLength + 1)) {
+    free(playerGrid);
+    return NULL;
   }
-  for (int i = 0; i < grid->numRows * grid->numColumns; i++) {  // iterate over all characters, filling in gaps in visible grid with known
-    if (newGrid[i] == Rock) {
-      if (knownGrid[i] == MyPlayer || isalpha(knownGrid[i]) || knownGrid[i] == GoldSpot) {  // known grid converts to room spot
-        knownGrid[i] = RoomSpot;
+  return playerGrid;
+}
 
-      }
-      newGrid[i] = knownGrid[i];
+/*************** grid_renderPlayerGrid() *************/
+/* see grid.h for description */
+bool
+grid_renderPlayerGrid(grid_t* grid, player_t* player, char* buffer, int bufferSize)
+{
+  if (grid == NULL || player == NULL || buffer == NULL || bufferSize <= grid->gridLength) {
+    return false;  // invalid parameter(s)
+  }
+  int playerIdx = player_getLoc(player);
+  uint64_t* seen = player_getSeen(player);
+  if (seen == NULL || playerIdx < 0 || playerIdx >= grid->numRows * grid->numColumns) {
+    return false;  // player hasn't been put into the grid
+  }
+  bool isCast;
+  uint64_t* visRow = getVisibleRow(grid, playerIdx, &isCast);
+  if (visRow == NULL) {
+    return false;
+  }
+  int gridLength = grid->gridLength;
+  int firstWord, lastWord;
+  litWords(grid, playerIdx, &firstWord, &lastWord);
+  // Nothing outside the lit words is in view, so they only show what's remembered
+  for (int w = 0; w < firstWord; w++) {
+    renderRemembered(grid, seen[w], w, buffer);
+  }
+  for (int w = firstWord; w <= lastWord; w++) {
+    uint64_t visBits = litBits(grid, playerIdx, w, visRow[w]);
+    seen[w] |= visBits;  // remember everything in view
+    int wordStart = w * 64;
+    if (wordStart + 64 <= gridLength && visBits == ~(uint64_t)0) {
+      memcpy(buffer + wordStart, grid->masterGrid + wordStart, 64);  // all in view
+      continue;
     }
+    // Start from the original grid, remembered though players and gold may have moved on, then patch the rest in
+    renderRemembered(grid, seen[w], w, buffer);
+    for (uint64_t bits = visBits; bits != 0; bits &= bits - 1) {
+      int i = wordStart + __builtin_ctzll(bits);
+      buffer[i] = grid->masterGrid[i];  // in view, so shown as it is now
+    }
+  }
+  for (int w = lastWord + 1; w * 64 < gridLength; w++) {
+    renderRemembered(grid, seen[w], w, buffer);
   }
-  return newGrid;
+  if (isCast) {
+    free(visRow);
+  }
+  buffer[playerIdx] = MyPlayer;
+  buffer[gridLength] = '\0';
+  return true;
 }
 
-/*************** grid_playerToGrid() *************/
+/*************** grid_renderPlayerStep() *************/
 /* see grid.h for description */
-void
-grid_playerToGrid(grid_t* grid, player_t* player, char letter){
-  if (grid != NULL && player != NULL  && letter >= 'A') { // ignore invalid parameters
-    int totalSpots = grid->numColumns * grid->numRows;
-    int location = rand() % totalSpots; // assign player to a random spot of what's accessible
-    while (grid->masterGrid[location] != RoomSpot) {  // only room spots count as possible starting locations
-      location = rand() % totalSpots;
+bool
+grid_renderPlayerStep(grid_t* grid, player_t* player, int renderedIdx, const int* changedIdxs, int numChanged,
+                      char* buffer, int bufferSize)
+{
+  if (grid == NULL || player == NULL || buffer == NULL || bufferSize <= grid->gridLength
+      || (numChanged > 0 && changedIdxs == NULL)) {
+    return false;  // invalid parameter(s)
+  }
+  int totalIndices = grid->numRows * grid->numColumns;
+  int playerIdx = player_getLoc(player);
+  uint64_t* seen = player_getSeen(player);
+  if (seen == NULL || playerIdx < 0 || playerIdx >= totalIndices) {
+    return false;  // player hasn't been put into the grid
+  }
+  if (numChanged < 0 || renderedIdx < 0 || renderedIdx >= totalIndices) {
+    return grid_renderPlayerGrid(grid, player, buffer, bufferSize);  // nothing to patch from
+  }
+  bool isCast, wasCast = false;
+  uint64_t* visRow = getVisibleRow(grid, playerIdx, &isCast);
+  uint64_t* prevRow = (renderedIdx == playerIdx) ? visRow : getVisibleRow(grid, renderedIdx, &wasCast);
+  if (visRow == NULL || prevRow == NULL) {
+    if (isCast) {
+      free(visRow);
     }
-    // get visible grid and update starting information
-    grid_updateMaster(grid, location, letter);
-    char* playerGrid = grid_getVisible(grid, location);
-    player_setGrid(player, playerGrid);
-    free(playerGrid);
-    player_setLoc(player, location);
+    if (wasCast) {
+      free(prevRow);
+    }
+    return false;
   }
+  // Only cells lit from one spot or the other can have come into or gone out of view
+  int firstWord, lastWord, prevFirstWord, prevLastWord;
+  litWords(grid, playerIdx, &firstWord, &lastWord);
+  litWords(grid, renderedIdx, &prevFirstWord, &prevLastWord);
+  firstWord = (prevFirstWord < firstWord) ? prevFirstWord : firstWord;
+  lastWord = (prevLastWord > lastWord) ? prevLastWord : lastWord;
+  for (int w = firstWord; w <= lastWord && renderedIdx != playerIdx; w++) {
+    uint64_t visBits = litBits(grid, playerIdx, w, visRow[w]);
+    uint64_t prevBits = litBits(grid, renderedIdx, w, prevRow[w]);
+    seen[w] |= visBits;  // remember everything in view
+    for (uint64_t bits = visBits & ~prevBits; bits != 0; bits &= bits - 1) {
+      int i = w * 64 + __builtin_ctzll(bits);
+      buffer[i] = grid->masterGrid[i];  // came into view
+    }
+    for (uint64_t bits = prevBits & ~visBits; bits != 0; bits &= bits - 1) {
+      int i = w * 64 + __builtin_ctzll(bits);
+      buffer[i] = originalAt(grid, i);  // went out of view, so remembered as the original map
+    }
+  }
+  // Cells that stayed in view only need patching where the master grid changed, as where the player stood did
+  for (int c = 0; c <= numChanged; c++) {
+    int i = (c < numChanged) ? changedIdxs[c] : renderedIdx;
+    if (i >= 0 && i < grid->gridLength && ((visRow[i / 64] >> (i % 64)) & 1) && inLight(grid, playerIdx, i)) {
+      buffer[i] = grid->masterGrid[i];
+    }
+    else if (i == renderedIdx) {
+      buffer[i] = originalAt(grid, i);  // seen, as the player stood there
+    }
+  }
+  if (isCast) {
+    free(visRow);
+  }
+  if (wasCast) {
+    free(prevRow);
+  }
+  buffer[playerIdx] = MyPlayer;
+  buffer[grid->gridLength] = '\0';
+  return true;
 }
 
-/*************** grid_delete() *************/
+/*************** renderRemembered() *************/
+/* Write word `word` of a player's grid into buffer as the player remembers
+ * it, given their seen bits for that word: the original grid where seen,
+ * rock elsewhere, and the newlines ending rows.
+ */
+static void
+renderRemembered(grid_t* grid, uint64_t seenBits, int word, char* buffer)
+{
+  int gridLength = grid->gridLength;
+  int numColumns = grid->numColumns;
+  int wordStart = word * 64;
+  int wordLength = (wordStart + 64 < gridLength) ? 64 : gridLength - wordStart;
+  if (seenBits == 0) {
+    // never seen: all rock, apart from the newlines ending rows
+    memset(buffer + wordStart, Rock, wordLength);
+    int firstNewline = wordStart + (numColumns - 1 - wordStart % numColumns);
+    for (int i = firstNewline; i < wordStart + wordLength; i += numColumns) {
+      buffer[i] = '\n';
+    }
+    return;
+  }
+  unpackOriginal(grid, wordStart, wordLength, buffer + wordStart);
+  uint64_t unseenBits = ~seenBits & (wordLength == 64 ? ~(uint64_t)0 : ((uint64_t)1 << wordLength) - 1);
+  for (; unseenBits != 0; unseenBits &= unseenBits - 1) {
+    int i = wordStart + __builtin_ctzll(unseenBits);
+    if (buffer[i] != '\n') {
+      buffer[i] = Rock;  // never seen, apart from the newlines ending rows
+    }
+  }
+}
+
+/*************** grid_setCacheBudget() *************/
 /* see grid.h for description */
 bool
-grid_delete(grid_t* grid)
+grid_setCacheBudget(grid_t* grid, long budgetBytes)
 {
-  if (grid == NULL) {
-    return false; // invalid param
-  }
-  if (grid->masterGrid != NULL) {
-    free(grid->masterGrid);
+  if (grid == NULL || budgetBytes < 0) {
+    return false;  // invalid parameter(s)
   }
-  if (grid->originalGrid != NULL) {
-    free(grid->originalGrid);
+  // Start over with the new budget; the cache is rebuilt on the next lookup
+  deleteFovCache(grid->fovCache);
+  grid->fovCache = NULL;
+  grid->cacheBudget = budgetBytes;
+  return true;
+}
+
+/*************** grid_getCacheStats() *************/
+/* see grid.h for description */
+bool
+grid_getCacheStats(grid_t* grid, long* hits, long* misses)
+{
+  if (grid == NULL || hits == NULL || misses == NULL) {
+    return false;  // invalid parameter(s)
   }
-  free(grid);
-  return true;  // successful delete
+  *hits = grid->cacheHits;
+  *misses = grid->cacheMisses;
+  return true;
 }
 
-/*************** grid_getNR() *************/
+/*************** grid_setLightRadius() *************/
 /* see grid.h for description */
-int
-grid_getNR(grid_t* grid)
+bool
+grid_setLightRadius(grid_t* grid, int radius)
 {
-  if (grid == NULL) {
-    return -1;  // invalid param
+  if (grid == NULL || radius < 0) {
+    return false;  // invalid parameter(s)
   }
-  return grid->numRows;
+  if (grid->builtRadius > 0 && (radius == 0 || radius > grid->builtRadius)) {
+    return false;  // the tables hold nothing beyond the radius they were built with
+  }
+  if (!setLightSpan(grid, radius)) {
+    return false;
+  }
+  // Cached fields of view were cast with the old radius
+  deleteFovCache(grid->fovCache);
+  grid->fovCache = NULL;
+  return true;
 }
 
-/*************** grid_getNC() *************/
+/*************** grid_setBuildThreads() *************/
 /* see grid.h for description */
-int
-grid_getNC(grid_t* grid)
+bool
+grid_setBuildThreads(int numThreads)
 {
-  if (grid == NULL) {
-    return -1;  // invalid param
+  if (numThreads < 0) {
+    return false;  // invalid parameter
   }
-  return grid->numColumns;
+  buildThreads = numThreads;
+  return true;
 }
 
-/*************** grid_getMasterGrid() *************/
+/*************** grid_setVectorRays() *************/
 /* see grid.h for description */
-char*
-grid_getMasterGrid(grid_t* grid)
+bool
+grid_setVectorRays(bool enabled)
 {
-  if (grid == NULL) {
-    return NULL;  // invalid param
+  walkRays = walkRaysScalar;
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if (enabled && __builtin_cpu_supports("avx2")) {
+    walkRays = walkRaysAVX2;
   }
-  return grid->masterGrid;
+#endif
+  return !enabled || walkRays != walkRaysScalar;
 }
 
-/*************** grid_getOriginalGrid() *************/
+/*************** grid_setTiledTerrain() *************/
 /* see grid.h for description */
-char*
-grid_getOriginalGrid(grid_t* grid)
+bool
+grid_setTiledTerrain(bool enabled)
 {
-  if (grid == NULL) {
-    return NULL; // invalid param
+  tiledTerrain = enabled;
+  return true;
+}
+
+/*************** grid_setDefaultLightRadius() *************/
+/* see grid.h for description */
+bool
+grid_setDefaultLightRadius(int radius)
+{
+  if (radius < 0) {
+    return false;  // invalid parameter
   }
-  return grid->originalGrid;
+  loadLightRadius = radius;
+  return true;
+}
+
+/*************** grid_setRoomCulling() *************/
+/* see grid.h for description */
+bool
+grid_setRoomCulling(bool enabled)
+{
+  roomCulling = enabled;
+  return true;
+}
+
+/*************** grid_setTableBudget() *************/
+/* see grid.h for description */
+bool
+grid_setTableBudget(long maxBytes)
+{
+  if (maxBytes < 0) {
+    return false;  // invalid parameter
+  }
+  tableBudget = maxBytes;
+  return true;
+}
+
+/*************** grid_getBuildStats() *************/
+/* see grid.h for description */
+bool
+grid_getBuildStats(grid_t* grid, int* numThreads, double* buildSeconds, long* memoryBytes)
+{
+  if (grid == NULL || numThreads == NULL || buildSeconds == NULL || memoryBytes == NULL) {
+    return false;  // invalid parameter(s)
+  }
+  *numThreads = grid->buildThreads;
+  *buildSeconds = grid->buildSeconds;
+  *memoryBytes = 0;
+  if (grid->visTable != NULL) {
+    *memoryBytes += (long)grid->numViewers * grid->gridWords * sizeof(uint64_t);
+  }
+  if (grid->seenByTable != NULL) {
+    *memoryBytes += (long)grid->numViewers * grid->viewerWords * sizeof(uint64_t);
+  }
+  if (grid->visRuns != NULL) {
+    *memoryBytes += grid->runStart[grid->numViewers] * sizeof(visRun_t) + (grid->numViewers + 1) * sizeof(long);
+  }
+  if (grid->engine == &cacheEngine) {
+    *memoryBytes += grid->cacheBudget;  // filled as views are cast
+  }
+  *memoryBytes += getTemplateBytes();  // shared with every other grid
+  return true;
+}
+
+/*************** grid_setEngine() *************/
+/* see grid.h for description */
+bool
+grid_setEngine(const char* name)
+{
+  if (name == NULL || strcmp(name, "auto") == 0) {
+    chosenEngine = NULL;
+    return true;
+  }
+  for (int e = 0; e < sizeof(visEngines) / sizeof(visEngines[0]); e++) {
+    if (strcmp(name, visEngines[e]->name) == 0) {
+      chosenEngine = visEngines[e];
+      return true;
+    }
+  }
+  return false;  // no such engine
+}
+
+/*************** grid_getEngine() *************/
+/* see grid.h for description */
+const char*
+grid_getEngine(grid_t* grid)
+{
+  if (grid == NULL) {
+    return NULL;  // invalid parameter
+  }
+  return grid->engine->name;
+}
+
+/*************** grid_getRegion() *************/
+/* see grid.h for description */
+int
+grid_getRegion(grid_t* grid, int idx)
+{
+  if (grid == NULL || grid->regionOf == NULL || idx < 0 || idx >= grid->numRows * grid->numColumns) {
+    return -1;  // invalid parameter(s)
+  }
+  return grid->regionOf[idx];
+}
+
+/*************** grid_getNumRegions() *************/
+/* see grid.h for description */
+int
+grid_getNumRegions(grid_t* grid)
+{
+  if (grid == NULL) {
+    return 0;
+  }
+  return grid->numRegions;
+}
+
+/*************** grid_getRegionInfo() *************/
+/* see grid.h for description */
+bool
+grid_getRegionInfo(grid_t* grid, int regionId, regionType_t* type, int* minRow, int* minCol,
+                   int* maxRow, int* maxCol, bool* isRect)
+{
+  if (grid == NULL || regionId < 0 || regionId >= grid->numRegions) {
+    return false;  // invalid parameter(s)
+  }
+  region_t* region = &grid->regions[regionId];
+  if (type != NULL) {
+    *type = region->type;
+  }
+  if (minRow != NULL) {
+    *minRow = region->minRow;
+  }
+  if (minCol != NULL) {
+    *minCol = region->minCol;
+  }
+  if (maxRow != NULL) {
+    *maxRow = region->maxRow;
+  }
+  if (maxCol != NULL) {
+    *maxCol = region->maxCol;
+  }
+  if (isRect != NULL) {
+    *isRect = region->isRect;
+  }
+  return true;
+}
+
+/*************** grid_getRegionNeighbors() *************/
+/* see grid.h for description */
+int
+grid_getRegionNeighbors(grid_t* grid, int regionId, const int** neighbors)
+{
+  if (grid == NULL || neighbors == NULL || regionId < 0 || regionId >= grid->numRegions) {
+    return -1;  // invalid parameter(s)
+  }
+  *neighbors = grid->regions[regionId].neighbors;
+  return grid->regions[regionId].numNeighbors;
+}
+
+/*************** grid_canSeeAny() *************/
+/* see grid.h for description */
+bool
+grid_canSeeAny(grid_t* grid, int playerIdx, int* cellIdxs, int numCells)
+{
+  int totalIndices = (grid != NULL) ? grid->numRows * grid->numColumns : 0;
+  if (grid == NULL || cellIdxs == NULL || playerIdx < 0 || playerIdx >= totalIndices) {
+    return false;  // invalid parameter(s)
+  }
+  for (int i = 0; i < numCells; i++) {
+    int cellIdx = cellIdxs[i];
+    if (cellIdx == playerIdx) {
+      return true;  // a player always sees their own spot
+    }
+    if (cellIdx < 0 || cellIdx >= totalIndices || !inLight(grid, playerIdx, cellIdx)) {
+      continue;  // ignore invalid indices, and ones too far away to see
+    }
+    if (grid->engine->canSee(grid, playerIdx, cellIdx)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*************** grid_getNumPiles() *************/
+/* see grid.h for description */
+int
+grid_getNumPiles(grid_t* grid)
+{
+  if (grid == NULL) {
+    return 0;
+  }
+  return grid->numPiles;
+}
+
+/*************** grid_removePile() *************/
+/* see grid.h for description */
+bool
+grid_removePile(grid_t* grid, int idx)
+{
+  if (grid == NULL || idx < 0 || idx >= grid->numRows * grid->numColumns || !grid->pileAt[idx]) {
+    return false;  // invalid parameter(s), or no pile there
+  }
+  grid->pileAt[idx] = false;
+  grid->numPiles--;
+  return true;
+}
+
+/*************** grid_playerToGrid() *************/
+/* see grid.h for description */
+void
+grid_playerToGrid(grid_t* grid, player_t* player, char letter){
+  if (grid != NULL && player != NULL  && letter >= 'A') { // ignore invalid parameters
+    int totalSpots = grid->numColumns * grid->numRows;
+    int location = rand() % totalSpots; // assign player to a random spot of what's accessible
+    while (grid->masterGrid[location] != RoomSpot) {  // only room spots count as possible starting locations
+      location = rand() % totalSpots;
+    }
+    // update starting information; the player has seen nothing until their first update
+    grid_updateMaster(grid, location, letter);
+    player_clearSeen(player, totalSpots);
+    player_setLoc(player, location);
+  }
+}
+
+/*************** buildPileIndex() *************/
+/* Index the numPiles gold piles placed on the master grid by grid index.
+ * Returns false on allocation error.
+ */
+static bool
+buildPileIndex(grid_t* grid, int numPiles)
+{
+  grid->numPiles = 0;
+  grid->pileAt = calloc(grid->numRows * grid->numColumns, sizeof(bool));
+  if (grid->pileAt == NULL) {
+    return false;
+  }
+
+  // Piles are only ever placed, so this one pass at load is the only time the map is searched for them
+  for (int idx = 0; idx < grid->gridLength && grid->numPiles < numPiles; idx++) {
+    if (grid->masterGrid[idx] == GoldSpot) {
+      grid->pileAt[idx] = true;
+      grid->numPiles++;
+    }
+  }
+  return true;
+}
+
+/*************** startChangeLog() *************/
+/* Set up an empty log of changes to the master grid, at version 0. Returns
+ * false on allocation error.
+ */
+static bool
+startChangeLog(grid_t* grid)
+{
+  grid->version = 0;
+  grid->changeLog = malloc(ChangeLogSize * sizeof(int));
+  grid->rowVersion = calloc(grid->numRows, sizeof(long));
+  grid->changeMarks = calloc(grid->gridWords, sizeof(uint64_t));
+  return grid->changeLog != NULL && grid->rowVersion != NULL && grid->changeMarks != NULL;
+}
+
+/*************** setMasterChar() *************/
+/* Put a character in the master grid, logging the change (if it is one) as
+ * the grid's next version.
+ */
+static void
+setMasterChar(grid_t* grid, int idx, char newChar)
+{
+  if (grid->masterGrid[idx] == newChar) {
+    return;  // nothing changes
+  }
+  grid->masterGrid[idx] = newChar;
+  grid->version++;
+  grid->changeLog[(grid->version - 1) % ChangeLogSize] = idx;
+  grid->rowVersion[idx / grid->numColumns] = grid->version;
+}
+
+/*************** buildRegions() *************/
+/* Label every traversable cell with a region: a room is a connected (8-way)
+ * set of room spots, a doorway is a single passage character next to (4-way)
+ * a room spot, and a passage segment is a connected set of the remaining
+ * passage characters. Records each region's bounding box and the regions a
+ * player could step to from it. On allocation error regionOf is left NULL.
+ */
+static void
+buildRegions(grid_t* grid)
+{
+  int numColumns = grid->numColumns;
+  int totalIndices = grid->numRows * numColumns;
+  int gridLength = grid->gridLength;  // may be short a trailing newline
+  grid->numRegions = 0;
+  grid->regions = NULL;
+  grid->regionOf = malloc(totalIndices * sizeof(int));
+  char* kindOf = malloc(totalIndices);  // region type of each index, -1 if not traversable
+  int* queue = malloc(totalIndices * sizeof(int));
+  if (grid->regionOf == NULL || kindOf == NULL || queue == NULL) {
+    fprintf(stderr, "buildRegions: error allocating memory for regions\n");
+    free(grid->regionOf);
+    grid->regionOf = NULL;
+    free(kindOf);
+    free(queue);
+    return;
+  }
+
+  // Classify each cell by what it is and what it touches
+  for (int i = 0; i < totalIndices; i++) {
+    grid->regionOf[i] = -1;
+    char c = (i < gridLength) ? originalAt(grid, i) : Rock;
+    kindOf[i] = -1;
+    if (c == RoomSpot) {
+      kindOf[i] = RoomRegion;
+    }
+    else if (c == Passage) {
+      int r = i / numColumns, col = i % numColumns;
+      bool nextToRoom = (r > 0 && originalAt(grid, i - numColumns) == RoomSpot)
+        || (i + numColumns < gridLength && originalAt(grid, i + numColumns) == RoomSpot)
+        || (col > 0 && originalAt(grid, i - 1) == RoomSpot)
+        || (i + 1 < gridLength && originalAt(grid, i + 1) == RoomSpot);
+      kindOf[i] = nextToRoom ? DoorwayRegion : PassageRegion;
+    }
+  }
+
+  // Flood fill each unlabeled cell's region
+  int maxRegions = 0;
+  for (int start = 0; start < totalIndices; start++) {
+    if (kindOf[start] < 0 || grid->regionOf[start] >= 0) {
+      continue;
+    }
+    if (grid->numRegions == maxRegions) {
+      maxRegions = (maxRegions == 0) ? 16 : 2 * maxRegions;
+      region_t* grown = realloc(grid->regions, maxRegions * sizeof(region_t));
+      if (grown == NULL) {
+        fprintf(stderr, "buildRegions: error allocating memory for regions\n");
+        break;
+      }
+      grid->regions = grown;
+    }
+    int id = grid->numRegions++;
+    region_t* region = &grid->regions[id];
+    region->type = kindOf[start];
+    region->minRow = region->maxRow = start / numColumns;
+    region->minCol = region->maxCol = start % numColumns;
+    region->numCells = 0;
+    region->numNeighbors = 0;
+    region->neighbors = NULL;
+
+    int head = 0, tail = 0;
+    queue[tail++] = start;
+    grid->regionOf[start] = id;
+    while (head < tail) {
+      int i = queue[head++];
+      int r = i / numColumns, c = i % numColumns;
+      region->numCells++;
+      region->minRow = (r < region->minRow) ? r : region->minRow;
+      region->maxRow = (r > region->maxRow) ? r : region->maxRow;
+      region->minCol = (c < region->minCol) ? c : region->minCol;
+      region->maxCol = (c > region->maxCol) ? c : region->maxCol;
+      if (region->type == DoorwayRegion) {
+        continue;  // every doorway cell is a region of its own
+      }
+      for (int dr = -1; dr <= 1; dr++) {
+        for (int dc = -1; dc <= 1; dc++) {
+          int nr = r + dr, nc = c + dc;
+          if (nr < 0 || nr >= grid->numRows || nc < 0 || nc >= numColumns) {
+            continue;
+          }
+          int n = nr * numColumns + nc;
+          if (kindOf[n] == region->type && grid->regionOf[n] < 0) {
+            grid->regionOf[n] = id;
+            queue[tail++] = n;
+          }
+        }
+      }
+    }
+    long area = (long)(region->maxRow - region->minRow + 1) * (region->maxCol - region->minCol + 1);
+    region->isRect = (region->type == RoomRegion && region->numCells == area);
+  }
+
+  // Connect regions a player can step between
+  for (int i = 0; i < totalIndices; i++) {
+    int id = grid->regionOf[i];
+    if (id < 0) {
+      continue;
+    }
+    int r = i / numColumns, c = i % numColumns;
+    for (int dr = -1; dr <= 1; dr++) {
+      for (int dc = -1; dc <= 1; dc++) {
+        int nr = r + dr, nc = c + dc;
+        if (nr < 0 || nr >= grid->numRows || nc < 0 || nc >= numColumns) {
+          continue;
+        }
+        int neighborId = grid->regionOf[nr * numColumns + nc];
+        if (neighborId >= 0 && neighborId != id) {
+          addRegionNeighbor(&grid->regions[id], neighborId);
+        }
+      }
+    }
+  }
+  free(kindOf);
+  free(queue);
+}
+
+/*************** addRegionNeighbor() *************/
+/* Add neighborId to a region's neighbors unless it's already there.
+ * Returns false on allocation error.
+ */
+static bool
+addRegionNeighbor(region_t* region, int neighborId)
+{
+  for (int n = 0; n < region->numNeighbors; n++) {
+    if (region->neighbors[n] == neighborId) {
+      return true;  // already known
+    }
+  }
+  int* grown = realloc(region->neighbors, (region->numNeighbors + 1) * sizeof(int));
+  if (grown == NULL) {
+    fprintf(stderr, "addRegionNeighbor: error allocating memory for neighbors\n");
+    return false;
+  }
+  region->neighbors = grown;
+  region->neighbors[region->numNeighbors++] = neighborId;
+  return true;
+}
+
+/*************** pickEngine() *************/
+/* Set up the grid's visibility engine: the one chosen with grid_setEngine,
+ * or else the fastest that fits in tableBudget (the full table, then the
+ * compressed one). If that can't be built, the grid falls back to the FOV
+ * cache, which is always there to fall back on.
+ */
+static void
+pickEngine(grid_t* grid)
+{
+  grid->visTable = NULL;
+  grid->seenByTable = NULL;
+  grid->runStart = NULL;
+  grid->visRuns = NULL;
+  grid->cacheBudget = DefaultCacheBytes;
+  grid->fovCache = NULL;
+  grid->cacheHits = 0;
+  grid->cacheMisses = 0;
+  grid->buildThreads = 1;
+  buildViewerSlots(grid);
+
+  grid->engine = NULL;
+  if (chosenEngine != NULL) {
+    grid->engine = chosenEngine->build(grid) ? chosenEngine : NULL;
+  }
+  else if (tableEngine.build(grid)) {
+    grid->engine = &tableEngine;
+  }
+  else if (runEngine.build(grid)) {
+    grid->engine = &runEngine;
+  }
+  if (grid->engine == NULL) {
+    grid->engine = &cacheEngine;
+    cacheEngine.build(grid);
+  }
+}
+
+/*************** buildViewerSlots() *************/
+/* Number the cells players can stand on (room spots and passages), each
+ * one's slot being its row in the visibility tables. Leaves viewerSlot NULL
+ * on allocation error, in which case no table can be built.
+ */
+static void
+buildViewerSlots(grid_t* grid)
+{
+  int totalIndices = grid->numRows * grid->numColumns;
+  int gridLength = grid->gridLength;  // may be short a trailing newline
+  grid->numViewers = 0;
+  grid->viewerWords = 0;
+  grid->viewerSlot = malloc(totalIndices * sizeof(int));
+  if (grid->viewerSlot == NULL) {
+    fprintf(stderr, "buildViewerSlots: error allocating memory for viewer slots\n");
+    return;
+  }
+  for (int i = 0; i < totalIndices; i++) {
+    if (i < gridLength && (originalAt(grid, i) == RoomSpot || originalAt(grid, i) == Passage)) {
+      grid->viewerSlot[i] = grid->numViewers++;  // players can only ever stand on room spots and passages
+    }
+    else {
+      grid->viewerSlot[i] = -1;
+    }
+  }
+  grid->viewerWords = (grid->numViewers + 63) / 64;
+}
+
+/*************** buildVisTable() *************/
+/* Precompute which grid indices are visible from every room spot and passage.
+ * Visibility is decided by the terrain in the original grid alone, so each
+ * traversable cell gets one row of bits (one bit per grid index) and
+ * grid_getVisible only has to scan that row; its reverse is built alongside.
+ * Returns false, keeping nothing, if the table, its reverse and the ray
+ * templates together are larger than tableBudget, before or after the build
+ * adds the templates it walks, or on allocation error.
+ */
+static bool
+buildVisTable(grid_t* grid)
+{
+  // The reverse table is kept too, as are the templates the rows are cast with, so all count against the budget
+  long tableBytes = (long)grid->numViewers * (grid->gridWords + grid->viewerWords) * sizeof(uint64_t);
+  if (grid->viewerSlot == NULL || tableBytes + getTemplateBytes() > tableBudget) {
+    return false;  // too big to keep around
+  }
+  grid->visTable = calloc(grid->numViewers * (long)grid->gridWords, sizeof(uint64_t));
+  if (grid->visTable == NULL) {
+    fprintf(stderr, "buildVisTable: error allocating memory for visibility table\n");
+    return false;
+  }
+  // Every ray on this grid fits in a table covering it, so workers only ever fill in templates, never move the table
+  if (growRayTemplates(grid->numRows, grid->numColumns)) {
+    grid->buildThreads = numBuildWorkers(grid);
+  }
+  runBuildWorkers(grid, grid->buildThreads, buildVisRows, NULL);
+  if (tableBytes + getTemplateBytes() > tableBudget) {
+    free(grid->visTable);  // the templates this build added leave no room for it
+    grid->visTable = NULL;
+    return false;
+  }
+  buildSeenByTable(grid);
+  return true;
+}
+
+/*************** buildVisRows() *************/
+/* Worker for buildVisTable: claim ViewerChunk grid indices at a time, until
+ * none are left, and cast the visibility row of each one players can stand on.
+ * Rows cost very different amounts, so workers share them out as they go.
+ */
+static void*
+buildVisRows(void* arg)
+{
+  buildWorker_t* worker = arg;
+  grid_t* grid = worker->grid;
+  int totalIndices = grid->numRows * grid->numColumns;
+  int first;
+  while ((first = __atomic_fetch_add(worker->nextViewer, ViewerChunk, __ATOMIC_RELAXED)) < totalIndices) {
+    int last = (first + ViewerChunk < totalIndices) ? first + ViewerChunk : totalIndices;
+    for (int viewer = first; viewer < last; viewer++) {
+      int slot = grid->viewerSlot[viewer];
+      if (slot >= 0) {
+        castVisible(grid, viewer, grid->visTable + (long)slot * grid->gridWords);
+      }
+    }
+  }
+  return NULL;
+}
+
+/*************** buildVisRuns() *************/
+/* Build the visibility table in compressed form, for maps too big for the
+ * dense one: each viewer's visible set is kept as runs of consecutive grid
+ * indices. A player mostly sees the rooms around them, whose rows are runs,
+ * so this grows with the visible area rather than the size of the map.
+ * Workers cast and encode rows into buffers of their own, which are then
+ * gathered into visRuns in viewer slot order. If the runs, with the ray
+ * templates as the build leaves them, would take more than tableBudget, or on
+ * allocation error, returns false leaving visRuns NULL; workers give up early
+ * once over what the templates left of the budget when they started.
+ */
+static bool
+buildVisRuns(grid_t* grid)
+{
+  if (grid->viewerSlot == NULL) {
+    return false;  // no slots to build rows for
+  }
+  int numWorkers = growRayTemplates(grid->numRows, grid->numColumns) ? numBuildWorkers(grid) : 1;
+  long runBudget = tableBudget - getTemplateBytes();  // what the templates leave
+  runBuild_t build;
+  build.totalRuns = 0;
+  build.maxRuns = (runBudget > 0) ? runBudget / sizeof(visRun_t) : 0;
+  build.buffers = calloc(numWorkers, sizeof(runBuffer_t));
+  build.firstRun = malloc(grid->numViewers * sizeof(long) + 1);
+  build.numRuns = malloc(grid->numViewers * sizeof(int) + 1);
+  build.builtBy = malloc(grid->numViewers + 1);
+  if (build.buffers != NULL && build.firstRun != NULL && build.numRuns != NULL && build.builtBy != NULL) {
+    grid->buildThreads = numWorkers;
+    runBuildWorkers(grid, numWorkers, buildRunRows, &build);
+    long totalRuns = 0;
+    bool failed = false;
+    for (int id = 0; id < numWorkers; id++) {
+      totalRuns += build.buffers[id].numRuns;
+      failed = failed || build.buffers[id].failed;
+    }
+    long runBytes = totalRuns * sizeof(visRun_t) + (grid->numViewers + 1) * sizeof(long);
+    runBudget = tableBudget - getTemplateBytes();  // templates walked by the build count too
+    if (!failed && runBytes <= runBudget) {
+      grid->runStart = malloc((grid->numViewers + 1) * sizeof(long));
+      grid->visRuns = malloc(totalRuns * sizeof(visRun_t) + 1);
+    }
+    if (grid->runStart != NULL && grid->visRuns != NULL) {
+      long numGathered = 0;
+      for (int slot = 0; slot < grid->numViewers; slot++) {
+        runBuffer_t* buffer = &build.buffers[build.builtBy[slot]];
+        grid->runStart[slot] = numGathered;
+        memcpy(grid->visRuns + numGathered, buffer->runs + build.firstRun[slot], build.numRuns[slot] * sizeof(visRun_t));
+        numGathered += build.numRuns[slot];
+      }
+      grid->runStart[grid->numViewers] = numGathered;
+    }
+    else {
+      if (failed || runBytes <= runBudget) {
+        fprintf(stderr, "buildVisRuns: error allocating memory for compressed visibility table\n");
+      }
+      free(grid->runStart);
+      free(grid->visRuns);
+      grid->runStart = NULL;
+      grid->visRuns = NULL;
+    }
+  }
+  else {
+    fprintf(stderr, "buildVisRuns: error allocating memory for workers\n");
+  }
+  if (build.buffers != NULL) {
+    for (int id = 0; id < numWorkers; id++) {
+      free(build.buffers[id].runs);
+    }
+  }
+  free(build.buffers);
+  free(build.firstRun);
+  free(build.numRuns);
+  free(build.builtBy);
+  return grid->visRuns != NULL;
+}
+
+/*************** buildRunRows() *************/
+/* Worker for buildVisRuns: claim ViewerChunk grid indices at a time, as in
+ * buildVisRows, casting each viewer's row and appending its runs to this
+ * worker's buffer. Stops early, marking the buffer failed, if out of memory.
+ */
+static void*
+buildRunRows(void* arg)
+{
+  buildWorker_t* worker = arg;
+  grid_t* grid = worker->grid;
+  runBuild_t* build = worker->data;
+  runBuffer_t* buffer = &build->buffers[worker->id];
+  int totalIndices = grid->numRows * grid->numColumns;
+  uint64_t* visRow = malloc(grid->gridWords * sizeof(uint64_t));
+  if (visRow == NULL) {
+    buffer->failed = true;
+    return NULL;
+  }
+  int first;
+  while ((first = __atomic_fetch_add(worker->nextViewer, ViewerChunk, __ATOMIC_RELAXED)) < totalIndices) {
+    if (__atomic_load_n(&build->totalRuns, __ATOMIC_RELAXED) > build->maxRuns) {
+      break;  // over budget, buildVisRuns will throw the runs away
+    }
+    long chunkStart = buffer->numRuns;
+    int last = (first + ViewerChunk < totalIndices) ? first + ViewerChunk : totalIndices;
+    for (int viewer = first; viewer < last; viewer++) {
+      int slot = grid->viewerSlot[viewer];
+      if (slot >= 0) {
+        memset(visRow, 0, grid->gridWords * sizeof(uint64_t));
+        castVisible(grid, viewer, visRow);
+        build->builtBy[slot] = worker->id;
+        build->firstRun[slot] = buffer->numRuns;
+        if (!appendRuns(buffer, visRow, grid->gridWords)) {
+          buffer->failed = true;
+          free(visRow);
+          return NULL;
+        }
+        build->numRuns[slot] = buffer->numRuns - build->firstRun[slot];
+      }
+    }
+    __atomic_fetch_add(&build->totalRuns, buffer->numRuns - chunkStart, __ATOMIC_RELAXED);
+  }
+  free(visRow);
+  return NULL;
+}
+
+/*************** appendRuns() *************/
+/* Append the runs of consecutive set bits in visRow to buffer, doubling its
+ * capacity as needed. Returns false on allocation error.
+ */
+static bool
+appendRuns(runBuffer_t* buffer, uint64_t* visRow, int gridWords)
+{
+  int runEnd = -1;  // one past the last index of the latest run
+  for (int w = 0; w < gridWords; w++) {
+    for (uint64_t bits = visRow[w]; bits != 0; bits &= bits - 1) {
+      int idx = w * 64 + __builtin_ctzll(bits);
+      if (idx == runEnd) {
+        buffer->runs[buffer->numRuns - 1].length++;  // extends the latest run
+      }
+      else {
+        if (buffer->numRuns == buffer->capacity) {
+          long newCapacity = (buffer->capacity > 0) ? 2 * buffer->capacity : 1024;
+          visRun_t* newRuns = realloc(buffer->runs, newCapacity * sizeof(visRun_t));
+          if (newRuns == NULL) {
+            return false;
+          }
+          buffer->runs = newRuns;
+          buffer->capacity = newCapacity;
+        }
+        buffer->runs[buffer->numRuns++] = (visRun_t){idx, 1};
+      }
+      runEnd = idx + 1;
+    }
+  }
+  return true;
+}
+
+/*************** runsContain() *************/
+/* Return true if idx is in the compressed visible set of a viewer slot,
+ * by binary search over its runs (which are in increasing index order).
+ */
+static bool
+runsContain(grid_t* grid, int slot, int idx)
+{
+  long low = grid->runStart[slot];
+  long high = grid->runStart[slot + 1];  // search runs low to high - 1
+  while (low < high) {
+    long mid = low + (high - low) / 2;
+    visRun_t* run = &grid->visRuns[mid];
+    if (idx < run->first) {
+      high = mid;
+    }
+    else if (idx >= run->first + run->length) {
+      low = mid + 1;
+    }
+    else {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*************** buildSeenByTable() *************/
+/* Build the reverse of the visibility table for the cells players can stand
+ * on: for each one, the set of viewer slots that can see it. Changes to the
+ * master grid only ever happen on these cells (players and gold), so this
+ * tells which players a change can affect. Left NULL on allocation error,
+ * in which case single lines of sight are checked instead.
+ */
+static void
+buildSeenByTable(grid_t* grid)
+{
+  grid->seenByTable = calloc(grid->numViewers * (long)grid->viewerWords, sizeof(uint64_t));
+  if (grid->seenByTable == NULL) {
+    fprintf(stderr, "buildSeenByTable: error allocating memory for reverse visibility table\n");
+    return;
+  }
+  runBuildWorkers(grid, grid->buildThreads, buildSeenByRows, NULL);
+}
+
+/*************** buildSeenByRows() *************/
+/* Worker for buildSeenByTable: reverse the rows of the viewers in every
+ * numWorkers-th 64-slot block, starting with block id. Each viewer only sets
+ * bits in its own block's word of each seenByTable row, so no two workers
+ * ever write the same word.
+ */
+static void*
+buildSeenByRows(void* arg)
+{
+  buildWorker_t* worker = arg;
+  grid_t* grid = worker->grid;
+  int totalIndices = grid->numRows * grid->numColumns;
+  for (int viewer = 0; viewer < totalIndices; viewer++) {
+    int viewerSlot = grid->viewerSlot[viewer];
+    if (viewerSlot >= 0 && (viewerSlot / 64) % worker->numWorkers == worker->id) {
+      // Every traversable cell in this viewer's row sees this viewer in turn
+      uint64_t* visRow = grid->visTable + (long)viewerSlot * grid->gridWords;
+      for (int w = 0; w < grid->gridWords; w++) {
+        uint64_t bits = visRow[w];
+        while (bits != 0) {
+          int cellSlot = grid->viewerSlot[w * 64 + __builtin_ctzll(bits)];
+          if (cellSlot >= 0) {
+            grid->seenByTable[(long)cellSlot * grid->viewerWords + viewerSlot / 64] |= (uint64_t)1 << (viewerSlot % 64);
+          }
+          bits &= bits - 1;  // clear lowest set bit
+        }
+      }
+    }
+  }
+  return NULL;
+}
+
+/*************** numBuildWorkers() *************/
+/* Return how many threads to build a grid's tables on: the number set with
+ * grid_setBuildThreads, or one per online core, but no more than
+ * MaxBuildThreads or one per 64 viewers (fewer wouldn't keep them busy).
+ */
+static int
+numBuildWorkers(grid_t* grid)
+{
+  long numWorkers = buildThreads;
+  if (numWorkers <= 0) {
+    numWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  int mostUseful = (grid->numViewers + 63) / 64;
+  if (numWorkers > mostUseful) {
+    numWorkers = mostUseful;
+  }
+  if (numWorkers > MaxBuildThreads) {
+    numWorkers = MaxBuildThreads;
+  }
+  return (numWorkers >= 1) ? numWorkers : 1;
+}
+
+/*************** runBuildWorkers() *************/
+/* Run work on numWorkers threads, the calling thread being worker 0, and
+ * wait for them all to finish. Every worker is handed the same data. A worker whose thread can't be started is
+ * run on the calling thread instead, so the work always gets done.
+ */
+static void
+runBuildWorkers(grid_t* grid, int numWorkers, void* (*work)(void*), void* data)
+{
+  buildWorker_t workers[numWorkers];
+  pthread_t threads[numWorkers];
+  bool started[numWorkers];
+  int nextViewer = 0;
+  for (int id = 0; id < numWorkers; id++) {
+    workers[id] = (buildWorker_t){grid, id, numWorkers, &nextViewer, data};
+  }
+  for (int id = 1; id < numWorkers; id++) {
+    started[id] = (pthread_create(&threads[id], NULL, work, &workers[id]) == 0);
+  }
+  work(&workers[0]);
+  for (int id = 1; id < numWorkers; id++) {
+    if (started[id]) {
+      pthread_join(threads[id], NULL);
+    }
+    else {
+      work(&workers[id]);
+    }
+  }
+}
+
+/*************** castVisible() *************/
+/* Compute every grid index visible from playerIdx, setting its bit in visRow.
+ * Uses the map's rooms to pick candidates, unless room culling was turned
+ * off or regions couldn't be labeled, and sweeps outward from the player
+ * otherwise; both give the same cells.
+ */
+static void
+castVisible(grid_t* grid, int playerIdx, uint64_t* visRow)
+{
+  memset(visRow, 0, grid->gridWords * sizeof(uint64_t));
+  if (grid->cullRooms) {
+    castThroughRooms(grid, playerIdx, visRow);
+  }
+  else {
+    sweepVisible(grid, playerIdx, visRow);
+  }
+}
+
+/*************** castThroughRooms() *************/
+/* Set the bit of every grid index visible from playerIdx, testing only cells
+ * a line of sight could reach. Only room spots let sight through (passages
+ * are opaque, doorways included), and a line that isn't blocked passes along
+ * a chain of them hugging it (see sweepVisible). So beyond the player's own
+ * neighbors, sight can only reach the rooms touching the player and the cells
+ * bordering them; every other room is culled without looking at it. Each
+ * candidate is confirmed with grid_isVisiblePoint, except the spots of a
+ * rectangular room the player is standing in, which all see each other.
+ */
+static void
+castThroughRooms(grid_t* grid, int playerIdx, uint64_t* visRow)
+{
+  int numColumns = grid->numColumns;
+  int pr = playerIdx / numColumns;  // player row
+  int pc = playerIdx % numColumns;  // player column
+  int lastCol = numColumns - 2;  // last column holds the newline
+  rayBatch_t batch = {.playerIdx = playerIdx, .numRays = 0};
+
+  // The player and their neighbors, noting which rooms they touch
+  int rooms[9];
+  int numRooms = 0;
+  for (int r = pr - 1; r <= pr + 1; r++) {
+    for (int c = pc - 1; c <= pc + 1; c++) {
+      if (r < 0 || r >= grid->numRows || c < 0 || c > lastCol) {
+        continue;
+      }
+      int idx = r * numColumns + c;
+      testVisible(grid, &batch, idx, visRow);
+      int region = grid->regionOf[idx];
+      if (region >= 0 && grid->regions[region].type == RoomRegion) {
+        bool isNew = true;
+        for (int i = 0; i < numRooms; i++) {
+          isNew = isNew && rooms[i] != region;
+        }
+        if (isNew) {
+          rooms[numRooms++] = region;
+        }
+      }
+    }
+  }
+
+  // Each touching room and the cells bordering it
+  for (int i = 0; i < numRooms; i++) {
+    region_t* room = &grid->regions[rooms[i]];
+    bool fillRoom = room->isRect && grid->regionOf[playerIdx] == rooms[i];
+    int firstRow = (room->minRow > 0) ? room->minRow - 1 : 0;
+    int lastRow = (room->maxRow < grid->numRows - 1) ? room->maxRow + 1 : grid->numRows - 1;
+    if (grid->lightRadius > 0) {
+      // nothing past the light radius needs looking at
+      firstRow = (pr - grid->lightRadius > firstRow) ? pr - grid->lightRadius : firstRow;
+      lastRow = (pr + grid->lightRadius < lastRow) ? pr + grid->lightRadius : lastRow;
+    }
+    for (int r = firstRow; r <= lastRow; r++) {
+      int halfWidth = lightHalfWidth(grid, abs(r - pr));
+      if (fillRoom && r >= room->minRow && r <= room->maxRow) {
+        int fillFirst = (pc - halfWidth > room->minCol) ? pc - halfWidth : room->minCol;
+        int fillLast = (pc + halfWidth < room->maxCol) ? pc + halfWidth : room->maxCol;
+        setBitRange(visRow, r * numColumns + fillFirst, r * numColumns + fillLast);
+      }
+      int firstCol = (room->minCol > 0) ? room->minCol - 1 : 0;
+      int endCol = (room->maxCol < lastCol) ? room->maxCol + 1 : lastCol;
+      firstCol = (pc - halfWidth > firstCol) ? pc - halfWidth : firstCol;
+      endCol = (pc + halfWidth < endCol) ? pc + halfWidth : endCol;
+      for (int c = firstCol; c <= endCol; c++) {
+        int idx = r * numColumns + c;
+        if ((visRow[idx / 64] >> (idx % 64)) & 1) {
+          continue;  // already visible
+        }
+        // A rectangular room's border is exactly its bounding box's; otherwise look for the room next door
+        bool bordersRoom = room->isRect;
+        for (int dr = -1; dr <= 1 && !bordersRoom; dr++) {
+          for (int dc = -1; dc <= 1 && !bordersRoom; dc++) {
+            int nr = r + dr, nc = c + dc;
+            bordersRoom = nr >= 0 && nr < grid->numRows && nc >= 0 && nc <= lastCol
+              && grid->regionOf[nr * numColumns + nc] == rooms[i];
+          }
+        }
+        if (bordersRoom) {
+          testVisible(grid, &batch, idx, visRow);
+        }
+      }
+    }
+  }
+  flushRays(grid, &batch, visRow);
+}
+
+/*************** testVisible() *************/
+/* Set idx's bit in visRow if it's visible from the batch's player, as
+ * grid_isVisiblePoint decides. Lines of sight that need walking are queued
+ * in the batch and walked together once it's full; call flushRays when done
+ * to walk the rest.
+ */
+static void
+testVisible(grid_t* grid, rayBatch_t* batch, int idx, uint64_t* visRow)
+{
+  lineVerdict_t verdict = prepareLine(grid, idx, batch->playerIdx, &batch->walks[batch->numRays]);
+  if (verdict == LineClear) {
+    visRow[idx / 64] |= (uint64_t)1 << (idx % 64);
+  }
+  else if (verdict == LineToWalk) {
+    batch->cellIdxs[batch->numRays++] = idx;
+    if (batch->numRays == RayBatchSize) {
+      flushRays(grid, batch, visRow);
+    }
+  }
+}
+
+/*************** flushRays() *************/
+/* Walk every line of sight queued in the batch, setting the bits of the
+ * cells at the end of the clear ones, and empty it.
+ */
+static void
+flushRays(grid_t* grid, rayBatch_t* batch, uint64_t* visRow)
+{
+  if (batch->numRays == 0) {
+    return;
+  }
+  unsigned clear = walkRays(grid, batch->walks, batch->numRays);
+  for (int i = 0; i < batch->numRays; i++) {
+    if ((clear >> i) & 1) {
+      visRow[batch->cellIdxs[i] / 64] |= (uint64_t)1 << (batch->cellIdxs[i] % 64);
+    }
+  }
+  batch->numRays = 0;
+}
+
+/*************** setBitRange() *************/
+/* Set bits first through last (inclusive) of a bitset, a word at a time. */
+static void
+setBitRange(uint64_t* bits, int first, int last)
+{
+  for (int w = first / 64; w <= last / 64; w++) {
+    uint64_t mask = ~(uint64_t)0;
+    if (w == first / 64) {
+      mask &= ~(uint64_t)0 << (first % 64);
+    }
+    if (w == last / 64) {
+      mask &= ~(uint64_t)0 >> (63 - last % 64);
+    }
+    bits[w] |= mask;
+  }
+}
+
+/*************** sweepVisible() *************/
+/* Compute every grid index visible from playerIdx, setting its bit in visRow
+ * (which must start out clear).
+ *
+ * The map around the player is swept in eight octants, each one line at a
+ * time moving away from the player along its major axis (columns for the
+ * shallow octants, rows for the steep ones). A line of sight that isn't
+ * blocked always passes along a chain of non-blocking cells hugging the line:
+ * each step moves one further out along the major axis, or one further out
+ * along the minor axis within the same line, wobbling at most one cell either
+ * way on the minor axis. So a cell is only a candidate if the player or an
+ * open cell one step back along such a chain was reached by the sweep. Each
+ * candidate is confirmed with grid_isVisiblePoint, and an octant stops as soon
+ * as a line has no open cells, so the work scales with the area in sight
+ * rather than the size of the map.
+ */
+static void
+sweepVisible(grid_t* grid, int playerIdx, uint64_t* visRow)
+{
+  int numColumns = grid->numColumns;
+  int pr = playerIdx / numColumns;  // player row
+  int pc = playerIdx % numColumns;  // player column
+
+  // Which cells of the previous and current line (indexed by distance along the minor axis) are open
+  int maxLine = (grid->numRows > numColumns ? grid->numRows : numColumns) + 1;
+  bool* prevOpen = malloc(maxLine * sizeof(bool));
+  bool* currOpen = malloc(maxLine * sizeof(bool));
+  if (prevOpen == NULL || currOpen == NULL) {
+    fprintf(stderr, "sweepVisible: error allocating memory for sweep lines\n");
+    free(prevOpen);
+    free(currOpen);
+    return;
+  }
+  rayBatch_t batch = {.playerIdx = playerIdx, .numRays = 0};
+
+  for (int octant = 0; octant < 8; octant++) {
+    int rowStep = (octant & 1) ? 1 : -1;  // sweep down or up
+    int colStep = (octant & 2) ? 1 : -1;  // sweep right or left
+    bool steep = (octant & 4) != 0;  // major axis is rows rather than columns
+    int maxRowDist = (rowStep > 0) ? grid->numRows - 1 - pr : pr;
+    int maxColDist = (colStep > 0) ? numColumns - 2 - pc : pc;  // last column holds the newline
+    int majorStride = steep ? rowStep * numColumns : colStep;
+    int minorStride = steep ? colStep : rowStep * numColumns;
+    int maxMajor = steep ? maxRowDist : maxColDist;
+    int maxMinor = steep ? maxColDist : maxRowDist;
+    if (grid->lightRadius > 0) {
+      // stop at the light radius
+      maxMajor = (grid->lightRadius < maxMajor) ? grid->lightRadius : maxMajor;
+      maxMinor = (grid->lightRadius < maxMinor) ? grid->lightRadius : maxMinor;
+    }
+    int prevFirst = 0;  // range of open cells in previous line
+    int prevLast = -1;
+
+    for (int major = 0; major <= maxMajor; major++) {
+      int first = -1;  // range of open cells in this line
+      int last = -1;
+      int start = (major == 0) ? 0 : (prevFirst > 0 ? prevFirst - 1 : 0);
+      int end = (major + 1 < maxMinor) ? major + 1 : maxMinor;  // octant plus a one cell overlap with its neighbor
+      for (int minor = start; minor <= end; minor++) {
+        bool lineOpen = minor > start && currOpen[minor - 1];
+        bool prevOpenNear = false;  // any open cell within one step on the previous line
+        for (int m = minor - 1; m <= minor + 1; m++) {
+          if (m >= prevFirst && m <= prevLast && prevOpen[m]) {
+            prevOpenNear = true;
+          }
+        }
+        if (!lineOpen && minor > prevLast + 1) {
+          break;  // the rest of this line is out of reach
+        }
+        currOpen[minor] = false;
+        if ((major == 0 && minor == 0) || lineOpen || (major > 0 && prevOpenNear)) {
+          int idx = playerIdx + major * majorStride + minor * minorStride;
+          int row = pr + (steep ? major : minor) * rowStep;
+          int col = pc + (steep ? minor : major) * colStep;
+          testVisible(grid, &batch, idx, visRow);
+          if (idx == playerIdx || !isOpaque(grid, row, col)) {
+            currOpen[minor] = true;  // sight may continue past this cell
+            if (first < 0) {
+              first = minor;
+            }
+            last = minor;
+          }
+        }
+      }
+      if (first < 0) {
+        break;  // no open cells left in this octant
+      }
+      bool* swap = prevOpen;
+      prevOpen = currOpen;
+      currOpen = swap;
+      prevFirst = first;
+      prevLast = last;
+    }
+  }
+  flushRays(grid, &batch, visRow);
+  free(prevOpen);
+  free(currOpen);
+}
+
+/*************** getVisibleRow() *************/
+/* Return the visibility bitset for playerIdx, as the grid's engine has it:
+ * a row it keeps, or a newly allocated one. Sets *isCast so the caller knows
+ * to free the row; NULL on allocation error.
+ */
+static uint64_t*
+getVisibleRow(grid_t* grid, int playerIdx, bool* isCast)
+{
+  return grid->engine->getRow(grid, playerIdx, isCast);
+}
+
+/*************** getTableRow() *************/
+/* Row getter of the table engine: the player's row of the visibility table,
+ * or a cast one for a spot players can't stand on.
+ */
+static uint64_t*
+getTableRow(grid_t* grid, int playerIdx, bool* isCast)
+{
+  int slot = (playerIdx < grid->numRows * grid->numColumns) ? grid->viewerSlot[playerIdx] : -1;
+  if (slot < 0) {
+    return castRow(grid, playerIdx, isCast);
+  }
+  *isCast = false;
+  return grid->visTable + (long)slot * grid->gridWords;  // precomputed row of the visibility table
+}
+
+/*************** getRunRow() *************/
+/* Row getter of the compressed table engine: the player's runs decoded into
+ * a new row, a run of bits at a time, or a cast one for a spot players can't
+ * stand on.
+ */
+static uint64_t*
+getRunRow(grid_t* grid, int playerIdx, bool* isCast)
+{
+  int slot = (playerIdx < grid->numRows * grid->numColumns) ? grid->viewerSlot[playerIdx] : -1;
+  if (slot < 0) {
+    return castRow(grid, playerIdx, isCast);
+  }
+  *isCast = true;
+  uint64_t* visRow = calloc(grid->gridWords, sizeof(uint64_t));
+  if (visRow == NULL) {
+    fprintf(stderr, "getRunRow: error allocating memory for visible bitset\n");
+    return NULL;
+  }
+  for (long r = grid->runStart[slot]; r < grid->runStart[slot + 1]; r++) {
+    setBitRange(visRow, grid->visRuns[r].first, grid->visRuns[r].first + grid->visRuns[r].length - 1);
+  }
+  return visRow;
+}
+
+/*************** getCacheRow() *************/
+/* Row getter of the cache engine: the player's row from the FOV cache, cast
+ * into it on a miss, or a cast one if the cache is disabled.
+ */
+static uint64_t*
+getCacheRow(grid_t* grid, int playerIdx, bool* isCast)
+{
+  uint64_t* cachedRow = getCachedRow(grid, playerIdx);
+  if (cachedRow == NULL) {
+    return castRow(grid, playerIdx, isCast);
+  }
+  *isCast = false;  // owned by the cache
+  return cachedRow;
+}
+
+/*************** castRow() *************/
+/* Row getter of the ray engine, and the others' fallback: a new row swept
+ * by castVisible.
+ */
+static uint64_t*
+castRow(grid_t* grid, int playerIdx, bool* isCast)
+{
+  *isCast = true;
+  uint64_t* visRow = malloc(grid->gridWords * sizeof(uint64_t));
+  if (visRow == NULL) {
+    fprintf(stderr, "castRow: error allocating memory for visible bitset\n");
+    return NULL;
+  }
+  castVisible(grid, playerIdx, visRow);  // no precomputed row for this index, sweep outward from the player instead
+  return visRow;
+}
+
+/*************** tableCanSee() *************/
+/* Visibility test of the table engine: look the player's spot up among the
+ * viewers of the cell, if both are spots players can stand on.
+ */
+static bool
+tableCanSee(grid_t* grid, int playerIdx, int cellIdx)
+{
+  int playerSlot = grid->viewerSlot[playerIdx];
+  int cellSlot = grid->viewerSlot[cellIdx];
+  if (grid->seenByTable == NULL || playerSlot < 0 || cellSlot < 0) {
+    return castCanSee(grid, playerIdx, cellIdx);  // no reverse index for this pair
+  }
+  uint64_t* seenByRow = grid->seenByTable + (long)cellSlot * grid->viewerWords;
+  return (seenByRow[playerSlot / 64] >> (playerSlot % 64)) & 1;
+}
+
+/*************** runsCanSee() *************/
+/* Visibility test of the compressed table engine: look the cell up in the
+ * player's runs, if the player's on a spot players can stand on.
+ */
+static bool
+runsCanSee(grid_t* grid, int playerIdx, int cellIdx)
+{
+  int playerSlot = grid->viewerSlot[playerIdx];
+  if (playerSlot < 0) {
+    return castCanSee(grid, playerIdx, cellIdx);
+  }
+  return runsContain(grid, playerSlot, cellIdx);
+}
+
+/*************** castCanSee() *************/
+/* Visibility test of the cache and ray engines: cast the one line of sight. */
+static bool
+castCanSee(grid_t* grid, int playerIdx, int cellIdx)
+{
+  return grid_isVisiblePoint(grid, cellIdx, playerIdx);
+}
+
+/*************** startCache() *************/
+/* Build function of the cache engine. Rows are cached as they're cast, so
+ * there's nothing to build; when picked with grid_setEngine the cache gets
+ * the whole budget but what the ray templates take, and as a fallback it
+ * keeps DefaultCacheBytes.
+ */
+static bool
+startCache(grid_t* grid)
+{
+  if (chosenEngine == &cacheEngine) {
+    long cacheBytes = tableBudget - getTemplateBytes();
+    grid->cacheBudget = (cacheBytes > 0) ? cacheBytes : 0;
+  }
+  return true;
+}
+
+/*************** startRays() *************/
+/* Build function of the ray engine: nothing to build, every row is cast. */
+static bool
+startRays(grid_t* grid)
+{
+  return true;
+}
+
+/*************** newFovCache() *************/
+/* Allocate an empty FOV cache with as many rows as fit in the grid's budget,
+ * counting the per-index lookup array against it. Returns NULL if fewer than
+ * two rows fit (callers hold two rows at once) or on allocation error.
+ */
+static fovCache_t*
+newFovCache(grid_t* grid)
+{
+  int totalIndices = grid->numRows * grid->numColumns;
+  long entryBytes = grid->gridWords * (long)sizeof(uint64_t) + 3 * (long)sizeof(int);
+  long capacity = (grid->cacheBudget - totalIndices * (long)sizeof(int)) / entryBytes;
+  if (capacity < 2) {
+    return NULL;  // budget too small to be useful
+  }
+  if (capacity > totalIndices) {
+    capacity = totalIndices;  // never more rows than there are spots
+  }
+  fovCache_t* cache = malloc(sizeof(fovCache_t));
+  if (cache == NULL) {
+    fprintf(stderr, "newFovCache: error allocating memory for cache\n");
+    return NULL;
+  }
+  cache->capacity = capacity;
+  cache->numUsed = 0;
+  cache->head = -1;
+  cache->tail = -1;
+  cache->entryOf = malloc(totalIndices * sizeof(int));
+  cache->entryIdx = malloc(capacity * sizeof(int));
+  cache->prev = malloc(capacity * sizeof(int));
+  cache->next = malloc(capacity * sizeof(int));
+  cache->rows = malloc(capacity * grid->gridWords * sizeof(uint64_t));
+  if (cache->entryOf == NULL || cache->entryIdx == NULL || cache->prev == NULL
+      || cache->next == NULL || cache->rows == NULL) {
+    fprintf(stderr, "newFovCache: error allocating memory for cache\n");
+    deleteFovCache(cache);
+    return NULL;
+  }
+  for (int i = 0; i < totalIndices; i++) {
+    cache->entryOf[i] = -1;
+  }
+  return cache;
+}
+
+/*************** getCachedRow() *************/
+/* Return the visibility row for playerIdx from the grid's FOV cache, sweeping
+ * it into the least recently used entry on a miss. The row stays valid through
+ * the next lookup, since the cache holds at least two rows.
+ * Returns NULL if the grid has no cache and one can't be made.
+ */
+static uint64_t*
+getCachedRow(grid_t* grid, int playerIdx)
+{
+  if (grid->fovCache == NULL && (grid->fovCache = newFovCache(grid)) == NULL) {
+    return NULL;
+  }
+  fovCache_t* cache = grid->fovCache;
+  int entry = cache->entryOf[playerIdx];
+  if (entry >= 0) {
+    grid->cacheHits++;
+    if (entry == cache->head) {
+      return cache->rows + (long)entry * grid->gridWords;
+    }
+    // unlink, to be moved to the front below
+    cache->next[cache->prev[entry]] = cache->next[entry];
+    if (cache->next[entry] >= 0) {
+      cache->prev[cache->next[entry]] = cache->prev[entry];
+    }
+    else {
+      cache->tail = cache->prev[entry];
+    }
+  }
+  else {
+    grid->cacheMisses++;
+    if (cache->numUsed < cache->capacity) {
+      entry = cache->numUsed++;  // fill empty entries first
+      if (cache->tail < 0) {
+        cache->tail = entry;
+      }
+    }
+    else {
+      // evict the least recently used row
+      entry = cache->tail;
+      cache->entryOf[cache->entryIdx[entry]] = -1;
+      cache->tail = cache->prev[entry];
+      cache->next[cache->tail] = -1;
+    }
+    cache->entryOf[playerIdx] = entry;
+    cache->entryIdx[entry] = playerIdx;
+    castVisible(grid, playerIdx, cache->rows + (long)entry * grid->gridWords);
+  }
+  // move to the front of the recency list
+  cache->prev[entry] = -1;
+  cache->next[entry] = cache->head;
+  if (cache->head >= 0) {
+    cache->prev[cache->head] = entry;
+  }
+  cache->head = entry;
+  return cache->rows + (long)entry * grid->gridWords;
+}
+
+/*************** deleteFovCache() *************/
+/* Free a FOV cache and everything in it; NULL is ignored. */
+static void
+deleteFovCache(fovCache_t* cache)
+{
+  if (cache == NULL) {
+    return;
+  }
+  free(cache->entryOf);
+  free(cache->entryIdx);
+  free(cache->prev);
+  free(cache->next);
+  free(cache->rows);
+  free(cache);
+}
+
+/*************** setLightSpan() *************/
+/* Set grid's light radius, and fill in lightSpan for it: for each row
+ * distance up to the radius, the largest c with rowDist^2 + c^2 <= radius^2.
+ * Returns false, leaving the radius as it was, on allocation error.
+ */
+static bool
+setLightSpan(grid_t* grid, int radius)
+{
+  int* lightSpan = malloc((radius + 1) * sizeof(int));
+  if (lightSpan == NULL) {
+    fprintf(stderr, "setLightSpan: error allocating memory for light span\n");
+    return false;
+  }
+  int halfWidth = radius;
+  for (int rowDist = 0; rowDist <= radius; rowDist++) {
+    while (halfWidth * halfWidth + rowDist * rowDist > radius * radius) {
+      halfWidth--;  // rows further out are never lit wider
+    }
+    lightSpan[rowDist] = halfWidth;
+  }
+  free(grid->lightSpan);
+  grid->lightSpan = lightSpan;
+  grid->lightRadius = radius;
+  return true;
+}
+
+/*************** lightHalfWidth() *************/
+/* Return how many columns either side of a player are lit rowDist rows above
+ * or below them (see setLightSpan); -1 if the whole row is out of the light,
+ * or numColumns if there's no limit.
+ */
+static int
+lightHalfWidth(grid_t* grid, int rowDist)
+{
+  if (grid->lightRadius <= 0) {
+    return grid->numColumns;
+  }
+  if (rowDist > grid->lightRadius) {
+    return -1;
+  }
+  return grid->lightSpan[rowDist];
+}
+
+/*************** inLight() *************/
+/* Return true if idx is within the light radius of playerIdx (always true
+ * when there's no radius).
+ */
+static bool
+inLight(grid_t* grid, int playerIdx, int idx)
+{
+  int radius = grid->lightRadius;
+  if (radius <= 0) {
+    return true;
+  }
+  int rowDist = idx / grid->numColumns - playerIdx / grid->numColumns;
+  int colDist = idx % grid->numColumns - playerIdx % grid->numColumns;
+  return rowDist * rowDist + colDist * colDist <= radius * radius;
+}
+
+/*************** litBits() *************/
+/* Return the bits of a word of a visibility row (word number `word`) whose
+ * grid indices are within the light radius of playerIdx: a mask is built
+ * from the lit span of each row the word covers.
+ */
+static uint64_t
+litBits(grid_t* grid, int playerIdx, int word, uint64_t bits)
+{
+  if (grid->lightRadius <= 0 || bits == 0) {
+    return bits;
+  }
+  int numColumns = grid->numColumns;
+  int pr = playerIdx / numColumns;
+  int pc = playerIdx % numColumns;
+  int wordStart = word * 64;
+  uint64_t mask = 0;
+  for (int r = wordStart / numColumns; r < grid->numRows && r * numColumns < wordStart + 64; r++) {
+    int halfWidth = lightHalfWidth(grid, abs(r - pr));
+    if (halfWidth < 0) {
+      continue;  // the whole row is dark
+    }
+    int firstCol = (pc - halfWidth > 0) ? pc - halfWidth : 0;
+    int lastCol = (pc + halfWidth < numColumns - 1) ? pc + halfWidth : numColumns - 1;
+    // The row's lit span as bit numbers within the word
+    int first = r * numColumns + firstCol - wordStart;
+    int last = r * numColumns + lastCol - wordStart;
+    first = (first > 0) ? first : 0;
+    last = (last < 63) ? last : 63;
+    if (first <= last) {
+      setBitRange(&mask, first, last);
+    }
+  }
+  return bits & mask;
+}
+
+/*************** litWords() *************/
+/* Set the range of words of a visibility row that can hold indices within
+ * the light radius of playerIdx: the rows the radius spans, or every word.
+ */
+static void
+litWords(grid_t* grid, int playerIdx, int* firstWord, int* lastWord)
+{
+  *firstWord = 0;
+  *lastWord = grid->gridWords - 1;
+  if (grid->lightRadius > 0) {
+    int pr = playerIdx / grid->numColumns;
+    int firstRow = (pr - grid->lightRadius > 0) ? pr - grid->lightRadius : 0;
+    int lastRow = (pr + grid->lightRadius < grid->numRows - 1) ? pr + grid->lightRadius : grid->numRows - 1;
+    *firstWord = firstRow * grid->numColumns / 64;
+    *lastWord = ((lastRow + 1) * grid->numColumns - 1) / 64;
+  }
+}
+
+/*************** buildOpacity() *************/
+/* Classify every character of the original grid once, setting the opacity
+ * bit of each cell whose character blocks sight, laid out row by row or in
+ * tiles as grid_setTiledTerrain last chose. Players and gold never block, so
+ * this never changes after the map is loaded.
+ */
+static void
+buildOpacity(grid_t* grid)
+{
+  grid->opacityTileShift = tiledTerrain ? OpacityTileShift : 0;
+  grid->opacityColumnWords = (grid->numColumns + 63) / 64;
+  int tileRows = (grid->numRows + (1 << grid->opacityTileShift) - 1) >> grid->opacityTileShift;
+  long numWords = ((long)tileRows * grid->opacityColumnWords) << grid->opacityTileShift;
+  grid->opacity = calloc(numWords, sizeof(uint64_t));
+  if (grid->opacity == NULL) {
+    fprintf(stderr, "buildOpacity: error allocating memory for opacity bitmap\n");
+    return;
+  }
+  for (int i = 0; i < grid->gridLength; i++) {
+    if (blocksSight(originalAt(grid, i))) {
+      int row = i / grid->numColumns;
+      int col = i % grid->numColumns;
+      grid->opacity[opacityWord(grid, row, col)] |= (uint64_t)1 << (col % 64);
+    }
+  }
+}
+
+/*************** buildPassageDegree() *************/
+/* Count each passage's neighboring passages once, so the corridor rule in
+ * grid_checkForVisiblePassage is a single lookup. Like opacity this only
+ * depends on the original grid; players standing in a corridor don't matter.
+ */
+static void
+buildPassageDegree(grid_t* grid)
+{
+  int totalIndices = grid->numRows * grid->numColumns;
+  grid->passageDegree = malloc(totalIndices);
+  if (grid->passageDegree == NULL) {
+    fprintf(stderr, "buildPassageDegree: error allocating memory for passage degrees\n");
+    return;
+  }
+  for (int i = 0; i < totalIndices; i++) {
+    grid->passageDegree[i] = countPassageNeighbors(grid, i);
+  }
+}
+
+/*************** countPassageNeighbors() *************/
+/* Return how many of the characters up/down/left/right of a passage in the
+ * original grid are passages too, ignoring neighbors off the edge of the
+ * map; 0 if the character isn't a passage.
+ */
+static int
+countPassageNeighbors(grid_t* grid, int idx)
+{
+  int numColumns = grid->numColumns;
+  int gridLength = grid->gridLength;
+  if (idx >= gridLength || originalAt(grid, idx) != Passage) {
+    return 0;
+  }
+  int numAdjacentPassage = 0;
+  if (idx - 1 >= 0 && originalAt(grid, idx - 1) == Passage) {
+    numAdjacentPassage++;
+  }
+  if (idx + 1 < gridLength && originalAt(grid, idx + 1) == Passage) {
+    numAdjacentPassage++;
+  }
+  if (idx + numColumns < gridLength && originalAt(grid, idx + numColumns) == Passage) {
+    numAdjacentPassage++;
+  }
+  if (idx - numColumns >= 0 && originalAt(grid, idx - numColumns) == Passage) {
+    numAdjacentPassage++;
+  }
+  return numAdjacentPassage;
+}
+
+/*************** opacityWord() *************/
+/* Return the word of the opacity bitmap holding the cell at (row, col), as
+ * bit col % 64. Every row starts a new word. Row by row, a row's words follow
+ * one another; tiled, each run of 8 consecutive words holds the same 64
+ * columns of 8 consecutive rows, so lines of sight running up and down the
+ * map stay in one cache line for 8 rows rather than moving to a new one
+ * every row.
+ */
+static long
+opacityWord(grid_t* grid, int row, int col)
+{
+  unsigned shift = grid->opacityTileShift;
+  unsigned tileRow = (unsigned)row >> shift;
+  return ((long)(tileRow * grid->opacityColumnWords + ((unsigned)col >> 6)) << shift) | ((unsigned)row & ((1u << shift) - 1));
+}
+
+/*************** isOpaque() *************/
+/* Return true if the terrain at the given row and column blocks sight. */
+static bool
+isOpaque(grid_t* grid, int row, int col)
+{
+  if (grid->opacity == NULL) {
+    return blocksSight(originalAt(grid, row * grid->numColumns + col));  // bitmap couldn't be allocated, classify the character instead
+  }
+  return (grid->opacity[opacityWord(grid, row, col)] >> ((unsigned)col & 63)) & 1;
+}
+
+/*************** anyOpaque() *************/
+/* Return true if the terrain at any column of a row from firstCol to lastCol
+ * (inclusive) blocks sight, testing 64 columns per word of the bitmap.
+ */
+static bool
+anyOpaque(grid_t* grid, int row, int firstCol, int lastCol)
+{
+  if (firstCol > lastCol) {
+    return false;  // empty range
+  }
+  if (grid->opacity == NULL) {
+    for (int col = firstCol; col <= lastCol; col++) {
+      if (blocksSight(originalAt(grid, row * grid->numColumns + col))) {
+        return true;
+      }
+    }
+    return false;
+  }
+  uint64_t* rowWords = grid->opacity + opacityWord(grid, row, 0);
+  int stride = 1 << grid->opacityTileShift;  // from one word of the row to the next
+  int firstWord = firstCol / 64;
+  int lastWord = lastCol / 64;
+  uint64_t firstMask = ~(uint64_t)0 << (firstCol % 64);  // bits at or after firstCol
+  uint64_t lastMask = ~(uint64_t)0 >> (63 - lastCol % 64);  // bits at or before lastCol
+  if (firstWord == lastWord) {
+    return (rowWords[firstWord * stride] & firstMask & lastMask) != 0;
+  }
+  if ((rowWords[firstWord * stride] & firstMask) != 0 || (rowWords[lastWord * stride] & lastMask) != 0) {
+    return true;
+  }
+  for (int w = firstWord + 1; w < lastWord; w++) {
+    if (rowWords[w * stride] != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*************** blocksSight() *************/
+/* Return true if the given map character blocks a line of sight. */
+static bool
+blocksSight(char gridChar)
+{
+  return gridChar == HorBdry || gridChar == VerBdry || gridChar == Corner || gridChar == Rock || gridChar == Passage;
+}
+
+/*************** mapFile() *************/
+/* Map a map file into memory, read only, setting mapLength to its size.
+ * Returns NULL if it can't be opened or mapped, or is empty; otherwise the
+ * caller unmaps it with munmap.
+ */
+static char*
+mapFile(const char* mapFilePath, int* mapLength)
+{
+  int fd = open(mapFilePath, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat fileStat;
+  char* map = NULL;
+  if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0 && fileStat.st_size < INT32_MAX) {
+    map = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      map = NULL;
+    }
+    *mapLength = (int)fileStat.st_size;
+  }
+  close(fd);  // the mapping stays valid without it
+  return map;
+}
+
+/*************** measureMap() *************/
+/* Find a map's number of rows and the width of its widest row (counting the
+ * newline ending each row), in one pass over its newlines. Sets evenRows to
+ * whether every row is that wide, so the map can be used as it is; the last
+ * row may be missing its newline either way. Returns false if no row has a
+ * character, or the map padded to its widest row would be too big to index.
+ */
+static bool
+measureMap(const char* map, int mapLength, int* numRows, int* numColumns, bool* evenRows)
+{
+  *numRows = 0;
+  *numColumns = 0;
+  *evenRows = true;
+  const char* mapEnd = map + mapLength;
+  for (const char* rowStart = map; rowStart < mapEnd; (*numRows)++) {
+    const char* newline = memchr(rowStart, '\n', mapEnd - rowStart);
+    int rowWidth = (newline == NULL) ? (int)(mapEnd - rowStart) + 1 : (int)(newline - rowStart) + 1;
+    if (*numRows > 0 && rowWidth != *numColumns) {
+      *evenRows = false;
+    }
+    if (rowWidth > *numColumns) {
+      *numColumns = rowWidth;
+    }
+    rowStart = (newline == NULL) ? mapEnd : newline + 1;
+  }
+  return *numColumns >= 2 && (long)*numRows * *numColumns < INT32_MAX;
+}
+
+/*************** padMap() *************/
+/* Copy a map whose rows differ in width into numRows rows of numColumns,
+ * padding each short row with rock before its newline, and ending the last
+ * row with one too. Returns NULL on memory allocation error; otherwise the
+ * caller frees it.
+ */
+static char*
+padMap(const char* map, int mapLength, int numRows, int numColumns)
+{
+  char* paddedMap = malloc((long)numRows * numColumns);
+  if (paddedMap == NULL) {
+    return NULL;
+  }
+  const char* mapEnd = map + mapLength;
+  const char* rowStart = map;
+  for (int row = 0; row < numRows; row++) {
+    const char* newline = memchr(rowStart, '\n', mapEnd - rowStart);
+    int rowLength = (newline == NULL) ? (int)(mapEnd - rowStart) : (int)(newline - rowStart);
+    char* paddedRow = paddedMap + (long)row * numColumns;
+    memcpy(paddedRow, rowStart, rowLength);
+    memset(paddedRow + rowLength, Rock, numColumns - 1 - rowLength);
+    paddedRow[numColumns - 1] = '\n';
+    rowStart = (newline == NULL) ? mapEnd : newline + 1;
+  }
+  return paddedMap;
+}
+
+/*************** releaseMap() *************/
+/* Release a map from mapFile, or the copy padMap made of it. */
+static void
+releaseMap(char* map, int mapLength, bool padded)
+{
+  if (padded) {
+    free(map);
+  }
+  else {
+    munmap(map, mapLength);
+  }
+}
+
+/*************** packOriginal() *************/
+/* Pack the map as read from its file into the grid's original grid, four
+ * bits per cell. Returns false, with an error message, if the map holds a
+ * character that isn't terrain or memory can't be allocated.
+ */
+static bool
+packOriginal(grid_t* grid, const char* mapString)
+{
+  grid->packedOriginal = calloc(grid->gridLength / 2 + 1, 1);
+  if (grid->packedOriginal == NULL) {
+    fprintf(stderr, "packOriginal: error allocating memory for original grid\n");
+    return false;
+  }
+  signed char codeOf[256];  // code of each character, -1 if it isn't terrain
+  memset(codeOf, -1, sizeof(codeOf));
+  for (int code = 0; code < NumTerrainChars; code++) {
+    codeOf[(unsigned char)TerrainChars[code]] = code;
+  }
+  for (int i = 0; i < grid->gridLength; i++) {
+    int code = codeOf[(unsigned char)mapString[i]];
+    if (code < 0) {
+      fprintf(stderr, "packOriginal: map has a character that isn't terrain, code %d, at row %d, column %d\n",
+              (unsigned char)mapString[i], i / grid->numColumns, i % grid->numColumns);
+      return false;
+    }
+    grid->packedOriginal[i / 2] |= code << (i % 2 * 4);
+  }
+  return true;
+}
+
+/*************** originalAt() *************/
+/* Return the character of the original grid at a grid index. */
+static char
+originalAt(grid_t* grid, int idx)
+{
+  return TerrainChars[(grid->packedOriginal[(unsigned)idx >> 1] >> ((idx & 1) << 2)) & 0xF];
+}
+
+/*************** unpackOriginal() *************/
+/* Write numCells characters of the original grid, from firstIdx on, into
+ * buffer, a whole byte (two cells) at a time wherever it can.
+ */
+static void
+unpackOriginal(grid_t* grid, int firstIdx, int numCells, char* buffer)
+{
+  int i = firstIdx;
+  int end = firstIdx + numCells;
+  if (i < end && (i & 1) != 0) {
+    *buffer++ = originalAt(grid, i++);
+  }
+  for (const unsigned char* packed = grid->packedOriginal + i / 2; i + 1 < end; i += 2, packed++) {
+    buffer[0] = TerrainChars[*packed & 0xF];
+    buffer[1] = TerrainChars[*packed >> 4];
+    buffer += 2;
+  }
+  if (i < end) {
+    *buffer = originalAt(grid, i);
+  }
+}
+
+/*************** grid_delete() *************/
+/* see grid.h for description */
+bool
+grid_delete(grid_t* grid)
+{
+  if (grid == NULL) {
+    return false; // invalid param
+  }
+  if (grid->masterGrid != NULL) {
+    free(grid->masterGrid);
+  }
+  if (grid->packedOriginal != NULL) {
+    free(grid->packedOriginal);
+  }
+  if (grid->originalGrid != NULL) {
+    free(grid->originalGrid);
+  }
+  if (grid->viewerSlot != NULL) {
+    free(grid->viewerSlot);
+  }
+  if (grid->visTable != NULL) {
+    free(grid->visTable);
+  }
+  if (grid->opacity != NULL) {
+    free(grid->opacity);
+  }
+  if (grid->passageDegree != NULL) {
+    free(grid->passageDegree);
+  }
+  if (grid->seenByTable != NULL) {
+    free(grid->seenByTable);
+  }
+  free(grid->runStart);
+  free(grid->visRuns);
+  deleteFovCache(grid->fovCache);
+  free(grid->lightSpan);
+  if (grid->regions != NULL) {
+    for (int r = 0; r < grid->numRegions; r++) {
+      free(grid->regions[r].neighbors);
+    }
+    free(grid->regions);
+  }
+  if (grid->regionOf != NULL) {
+    free(grid->regionOf);
+  }
+  free(grid->pileAt);
+  free(grid->changeLog);
+  free(grid->rowVersion);
+  free(grid->changeMarks);
+  free(grid);
+  if (--numLiveGrids == 0) {
+    freeRayTemplates();  // nobody left to share them with
+  }
+  return true;  // successful delete
+}
+
+/*************** grid_getNR() *************/
+/* see grid.h for description */
+int
+grid_getNR(grid_t* grid)
+{
+  if (grid == NULL) {
+    return -1;  // invalid param
+  }
+  return grid->numRows;
+}
+
+/*************** grid_getNC() *************/
+/* see grid.h for description */
+int
+grid_getNC(grid_t* grid)
+{
+  if (grid == NULL) {
+    return -1;  // invalid param
+  }
+  return grid->numColumns;
+}
+
+/*************** grid_getLength() *************/
+/* see grid.h for description */
+int
+grid_getLength(grid_t* grid)
+{
+  if (grid == NULL) {
+    return -1;  // invalid param
+  }
+  return grid->gridLength;
+}
+
+/*************** grid_getMasterGrid() *************/
+/* see grid.h for description */
+char*
+grid_getMasterGrid(grid_t* grid)
+{
+  if (grid == NULL) {
+    return NULL;  // invalid param
+  }
+  return grid->masterGrid;
+}
+
+/*************** grid_getOriginalGrid() *************/
+/* see grid.h for description */
+char*
+grid_getOriginalGrid(grid_t* grid)
+{
+  if (grid == NULL) {
+    return NULL; // invalid param
+  }
+  if (grid->originalGrid == NULL) {
+    // The original grid never changes, so it's unpacked once, and only if asked for whole
+    grid->originalGrid = malloc(grid->gridLength + 1);
+    if (grid->originalGrid == NULL) {
+      fprintf(stderr, "grid_getOriginalGrid: error allocating memory for original grid\n");
+      return NULL;
+    }
+    unpackOriginal(grid, 0, grid->gridLength, grid->originalGrid);
+    grid->originalGrid[grid->gridLength] = '\0';
+  }
+  return grid->originalGrid;
+}
+
+/*************** grid_getOriginalChar() *************/
+/* see grid.h for description */
+char
+grid_getOriginalChar(grid_t* grid, int idx)
+{
+  if (grid == NULL || idx < 0 || idx >= grid->gridLength) {
+    return '\0'; // invalid param(s)
+  }
+  return originalAt(grid, idx);
 }
@@ -15,6 +15,13 @@
 /**************** global types ****************/
 typedef struct grid grid_t;
 
+// Kinds of region a traversable cell can belong to
+typedef enum regionType {
+  RoomRegion,  // connected room spots
+  DoorwayRegion,  // a passage character next to a room spot
+  PassageRegion  // connected passage characters away from rooms
+} regionType_t;
+
 
 /**************** functions ****************/
 
@@ -28,7 +35,9 @@ typedef struct grid grid_t;
  * We guarantee:
  *   A NULL map file path is ignored
  *   Otherwise, the grid is initialized with the map file.
- *      Creates string for original grid loaded from file and separate master grid with gold distributed 
+ *      Creates original grid loaded from file, packed four bits per cell, and separate master grid string with gold distributed 
+ *      A map with a character other than rock, boundaries, corners, room spots, passages and newlines
+ *      (so also one with Windows line endings) is an error; rows shorter than the widest are padded with rock
  *   Gold is randomly distributed given constraints and the pointer to the number of piles is updated
  * Caller is responsible for:
  *   providing valid map file contents, if readable
@@ -48,9 +57,45 @@ grid_t* grid_initialize(char* mapFilePath, int goldMinNumPiles, int goldMaxNumPi
  * We guarantee:
  *   A null grid or index less than 0 or greater number of indices in grid is ignored 
  *   If no error, character is inserted in the grid
+ *   A character that differs from the one already there is logged as a change (see grid_getChangesSince)
  */
 bool grid_updateMaster(grid_t* grid, int idx, char addedChar);
 
+/**************** grid_getVersion ****************/
+/* Get the version of a grid's master grid: the number of changes made to it since load, or -1 if
+ * the grid is null. Every change grid_updateMaster makes adds one.
+ */
+long grid_getVersion(grid_t* grid);
+
+/**************** grid_getChangesSince ****************/
+/* Find the cells of the master grid that changed after a given version.
+ *
+ * Caller provides
+ *   valid grid, version (as from grid_getVersion), array for the changed grid indices and its length
+ *   (may be NULL if the length is 0).
+ * We return:
+ *   the number of cells changed since that version, or -1 if error or if the version is too old for
+ *   the changes since to be remembered, in which case the caller must assume everything changed.
+ * We guarantee:
+ *   A null grid, a version from the future, or a null array with a positive length, is ignored
+ *   Each cell is listed once, most recently changed first, as many as fit in the array
+ *   The last 4096 changes are remembered, and the work done is proportional to their number
+ */
+int grid_getChangesSince(grid_t* grid, long version, int* changedIdxs, int maxIdxs);
+
+/**************** grid_rowChangedSince ****************/
+/* Check whether any cell in a row of the master grid changed after a given version.
+ *
+ * Caller provides
+ *   valid grid, row number, version (as from grid_getVersion).
+ * We return:
+ *   true if the row changed since that version, false if not or on error.
+ * We guarantee:
+ *   A null grid or invalid row is ignored
+ *   Answers for any version, however old
+ */
+bool grid_rowChangedSince(grid_t* grid, int row, long version);
+
 /**************** grid_getVisible ****************/
 /* Get a visible map as a string given an index in the grid.
  *
@@ -74,6 +119,7 @@ char* grid_getVisible(grid_t* grid, int playerIdx);
  * We guarantee:
  *   A null grid or non passageway character is ignored 
  *   True is returned if a passage character is visible from given coordinate, false otherwise
+ *   Passage neighbors are counted once at load, so this is a single lookup
  */
 bool grid_checkForVisiblePassage(grid_t* grid, int mapPointIdx, int mr, int pr, int mc, int pc);
 
@@ -87,22 +133,324 @@ bool grid_checkForVisiblePassage(grid_t* grid, int mapPointIdx, int mr, int pr,
  * We guarantee:
  *   A null grid or invalid index provided for either coordinate is ignored 
  *   True is returned if the given pair of coordinates can see one another, false otherwise
+ * Note
+ *   The line between the two is walked exactly, in whole numbers. A line passing through a cell's
+ *   center is blocked if that cell blocks sight; one passing between two cells only if both do.
+ *   This deliberately differs from the original floating-point walk, whose rounding let a line
+ *   passing exactly through a corner slip past it: such pairs are now hidden (540 of them over
+ *   the maps in maps/, all through a '+'; see DESIGN.md). gridtest pins the answers for those maps.
  */
 bool grid_isVisiblePoint(grid_t* grid, int mapPointIdx, int playerIdx);
 
 /**************** grid_updatePlayerGrid ****************/
-/* Create a given player's grid by combining their current grid and their visible grid based on their current location.
+/* Create a given player's grid by combining what they've seen before with their visible grid based on their current location.
  *
  * Caller provides
- *   valid grid, valid player.
+ *   valid grid, valid player placed by grid_playerToGrid.
  * We return:
  *   a string representing the character's combined 'known' and visible grid or null if error
+ *   Caller is responsible for freeing the string
  * We guarantee:
- *   A null grid or invalid index provided for either coordinate is ignored 
- *   True is returned if the given pair of coordinates can see one another, false otherwise
+ *   A null grid or player, or a player without a location or seen bitset, is ignored
+ *   Every visible index is added to the player's seen bitset
+ *   Visible indices show the master grid, other seen indices the original map (so no players or gold)
  */
 char* grid_updatePlayerGrid(grid_t* grid, player_t* player);
 
+/**************** grid_renderPlayerGrid ****************/
+/* As grid_updatePlayerGrid, but writes the player's grid into a buffer the caller owns instead of allocating one.
+ *
+ * Caller provides
+ *   valid grid, valid player placed by grid_playerToGrid,
+ *   buffer and its size, at least grid_getLength(grid) + 1 characters.
+ * We return:
+ *   true and fill in the buffer with a null-terminated grid string, or false if error.
+ * We guarantee:
+ *   A null grid, player or buffer, a buffer too small, or a player without a location or seen bitset, is ignored
+ *   Nothing is allocated when the player's visibility comes from the visibility table or cache
+ */
+bool grid_renderPlayerGrid(grid_t* grid, player_t* player, char* buffer, int bufferSize);
+
+/**************** grid_renderPlayerStep ****************/
+/* As grid_renderPlayerGrid, but patches a buffer already holding the player's grid instead of rewriting it.
+ *
+ * Caller provides
+ *   valid grid, valid player placed by grid_playerToGrid,
+ *   the grid index the player stood on when the buffer was last rendered for them,
+ *   the indices of the master grid changed since (see grid_getChangesSince) and how many there are,
+ *   or -1 if that isn't known, in which case the whole grid is rendered,
+ *   buffer holding that render, and its size, at least grid_getLength(grid) + 1 characters.
+ * We return:
+ *   true and leave the buffer holding the player's grid as grid_renderPlayerGrid would render it, or false if error.
+ * We guarantee:
+ *   A null grid, player or buffer, a buffer too small, a null list of changes, or a player without a location or
+ *   seen bitset, is ignored
+ *   Only the cells that came into or went out of view, the changed cells in view and the two spots the player
+ *   stood on are written, so a step costs what the view changed by, plus a pass over the visibility rows
+ *   of the two spots (just the words the light radius spans, if there is one)
+ */
+bool grid_renderPlayerStep(grid_t* grid, player_t* player, int renderedIdx, const int* changedIdxs, int numChanged,
+                           char* buffer, int bufferSize);
+
+/**************** grid_setCacheBudget ****************/
+/* Set how much memory a grid's field-of-view cache may use.
+ *
+ * Caller provides
+ *   valid grid, budget in bytes (0 disables the cache).
+ * We return:
+ *   true if the budget was set, false if error.
+ * We guarantee:
+ *   A null grid or negative budget is ignored
+ *   Anything already cached is dropped; hit and miss counts are kept
+ * Note
+ *   The cache only serves maps too big for a full visibility table, keeping
+ *   the most recently used fields of view (16MB by default)
+ */
+bool grid_setCacheBudget(grid_t* grid, long budgetBytes);
+
+/**************** grid_getCacheStats ****************/
+/* Report how often a grid's field-of-view cache has been hit and missed.
+ *
+ * Caller provides
+ *   valid grid, pointers for the hit and miss counts.
+ * We return:
+ *   true and set both counts, or false if error.
+ * We guarantee:
+ *   A null grid or pointer is ignored
+ *   Both counts stay 0 on maps with a full visibility table
+ */
+bool grid_getCacheStats(grid_t* grid, long* hits, long* misses);
+
+/**************** grid_setLightRadius ****************/
+/* Limit how far players can see.
+ *
+ * Caller provides
+ *   valid grid, radius in grid cells (0 for no limit, the default).
+ * We return:
+ *   true if the radius was set, false if error.
+ * We guarantee:
+ *   A null grid or negative radius is ignored
+ *   Afterwards nothing is visible (in grid_getVisible, grid_isVisiblePoint and the functions built on them)
+ *   beyond the circle of that radius around the player, and field-of-view work stops at its edge
+ * Note
+ *   Meant to be set before players join; views already sent aren't revisited
+ *   A grid whose visibility tables were built for a radius (see grid_setDefaultLightRadius) can't
+ *   have it widened or removed, and false is returned
+ */
+bool grid_setLightRadius(grid_t* grid, int radius);
+
+/**************** grid_setDefaultLightRadius ****************/
+/* Set the light radius grids start with, and build their visibility tables for.
+ *
+ * Caller provides
+ *   radius in grid cells (0 for no limit, the default).
+ * We return:
+ *   true if set, false if the radius is negative.
+ * Note
+ *   Applies to every grid_initialize call after this one. Nothing beyond the radius is cast at
+ *   load, so tables and lines of sight cost what the lit circle does rather than the whole map
+ */
+bool grid_setDefaultLightRadius(int radius);
+
+/**************** grid_setBuildThreads ****************/
+/* Set how many threads grids initialized from now on build their visibility tables on.
+ *
+ * Caller provides
+ *   number of threads, or 0 for one per online core (the default).
+ * We return:
+ *   true if set, false if the number is negative.
+ * Note
+ *   Applies to every grid_initialize call after this one; small maps use fewer threads than asked for
+ */
+bool grid_setBuildThreads(int numThreads);
+
+/**************** grid_setVectorRays ****************/
+/* Choose whether lines of sight are walked 8 checks at a time with AVX2 or one check at a time.
+ *
+ * Caller provides
+ *   true for vector rays (the default), false for scalar ones.
+ * We return:
+ *   true if set, false if vector rays were asked for but this CPU can't run them (scalar is used instead).
+ * We guarantee:
+ *   Both give exactly the same visibility; only the speed of building tables and casting views changes
+ * Note
+ *   Applies to every grid; don't call it while grids are being initialized on other threads
+ */
+bool grid_setVectorRays(bool enabled);
+
+/**************** grid_setTiledTerrain ****************/
+/* Choose how the terrain grids keep for lines of sight is laid out in memory.
+ *
+ * Caller provides
+ *   true to keep it in tiles of 8 rows by 64 columns, false to keep it row by row (the default).
+ * We return:
+ *   true.
+ * We guarantee:
+ *   Both give exactly the same visibility; tiles keep lines of sight running up and down the map
+ *   within fewer cache lines, which helps on maps too big for the terrain to stay in cache
+ * Note
+ *   Applies to every grid_initialize call after this one; the map strings, and everything sent to
+ *   clients, stay row by row either way
+ */
+bool grid_setTiledTerrain(bool enabled);
+
+/**************** grid_setRoomCulling ****************/
+/* Choose how a grid casts a view: through the rooms touching the player's, or by sweeping outward from the player.
+ *
+ * Caller provides
+ *   true to cull every room sight can't reach (the default), false to sweep the view eighth by eighth.
+ * We return:
+ *   true.
+ * We guarantee:
+ *   Both give exactly the same visibility; the sweep is also used whenever a map's rooms can't be labeled
+ * Note
+ *   Applies to every grid_initialize call after this one; lets the sweep be tested and timed
+ */
+bool grid_setRoomCulling(bool enabled);
+
+/**************** grid_setTableBudget ****************/
+/* Set the most memory a grid's visibility engine may take.
+ *
+ * Caller provides
+ *   number of bytes (64 MiB by default).
+ * We return:
+ *   true if set, false if the number is negative.
+ * Note
+ *   Applies to every grid_initialize call after this one. Without an engine set, a map whose table
+ *   and reverse table together would be bigger gets a compressed table of visible runs instead, and if that's bigger too, a
+ *   cache of recently cast views. A cache engine set with grid_setEngine gets the whole budget.
+ *   The ray templates lines of sight are walked with, shared by every grid, count against each
+ *   grid's budget along with its engine, as they stand once its tables are built.
+ */
+bool grid_setTableBudget(long maxBytes);
+
+/**************** grid_setEngine ****************/
+/* Choose how grids work out which cells a spot can see.
+ *
+ * Caller provides
+ *   name of an engine: "table" (a full table built at load), "runs" (a compressed table built at
+ *   load), "cache" (views cast as needed, the most recent kept), "rays" (views cast every time),
+ *   or "auto" or NULL for the fastest that fits in the budget (the default).
+ * We return:
+ *   true if set, false if there's no engine by that name.
+ * We guarantee:
+ *   Every engine gives exactly the same visibility; they only differ in speed and memory
+ * Note
+ *   Applies to every grid_initialize call after this one. An engine whose table is over budget
+ *   can't be built, and the grid falls back to the cache (see grid_getEngine).
+ */
+bool grid_setEngine(const char* name);
+
+/**************** grid_getEngine ****************/
+/* Get the name of the engine a grid works out visibility with.
+ *
+ * Caller provides
+ *   valid grid.
+ * We return:
+ *   the engine's name, as given to grid_setEngine, or NULL if error.
+ * We guarantee:
+ *   A null grid is ignored
+ */
+const char* grid_getEngine(grid_t* grid);
+
+/**************** grid_getBuildStats ****************/
+/* Report how a grid's visibility engine was built.
+ *
+ * Caller provides
+ *   valid grid, pointers for the number of threads, the build time and the engine's memory.
+ * We return:
+ *   true and fill in all three, or false if error.
+ * We guarantee:
+ *   A null grid or pointer is ignored
+ *   The build time covers every table built at load, in seconds of wall-clock time
+ *   The memory is what the grid's engine (see grid_getEngine) takes, in bytes: the visibility
+ *   table and its reverse, the compressed table, the cache's budget, or 0 for rays, plus the
+ *   ray templates shared by every grid, which keep growing as views are cast
+ */
+bool grid_getBuildStats(grid_t* grid, int* numThreads, double* buildSeconds, long* memoryBytes);
+
+/**************** grid_getRegion ****************/
+/* Get the region a grid index belongs to.
+ *
+ * Caller provides
+ *   valid grid, index in grid string.
+ * We return:
+ *   the region id (0 to number of regions - 1), or -1 if players can't stand there or error.
+ * We guarantee:
+ *   A null grid or invalid index is ignored
+ * Note
+ *   Regions are labeled once at load from the original map: a room is a connected set of room spots,
+ *   a doorway a single passage character beside a room spot, and a passage segment a connected set of
+ *   the other passage characters (connected in any of the 8 directions players move)
+ */
+int grid_getRegion(grid_t* grid, int idx);
+
+/**************** grid_getNumRegions ****************/
+/* Get the number of regions in a grid, or 0 if the grid is null. */
+int grid_getNumRegions(grid_t* grid);
+
+/**************** grid_getRegionInfo ****************/
+/* Describe a region.
+ *
+ * Caller provides
+ *   valid grid, region id, pointers for its type, inclusive bounding box and whether it's a rectangular room;
+ *   any pointer may be null if that value isn't wanted.
+ * We return:
+ *   true and fill in the values, or false if error.
+ * We guarantee:
+ *   A null grid or invalid region id is ignored
+ *   A rectangular room fills its bounding box, so each of its spots can see every other
+ */
+bool grid_getRegionInfo(grid_t* grid, int regionId, regionType_t* type, int* minRow, int* minCol,
+                        int* maxRow, int* maxCol, bool* isRect);
+
+/**************** grid_getRegionNeighbors ****************/
+/* Get the regions a player can step to from a region.
+ *
+ * Caller provides
+ *   valid grid, region id, pointer to receive the array of neighboring region ids.
+ * We return:
+ *   the number of neighbors, or -1 if error.
+ * We guarantee:
+ *   A null grid or pointer, or invalid region id, is ignored
+ *   The array belongs to the grid and lasts until grid_delete
+ */
+int grid_getRegionNeighbors(grid_t* grid, int regionId, const int** neighbors);
+
+/**************** grid_canSeeAny ****************/
+/* Check if a player at a given index can see any of a set of grid indices.
+ *
+ * Caller provides
+ *   valid grid, index of player's coordinates in grid, array of grid indices and its length.
+ * We return:
+ *   true if any of the indices is the player's own or visible from it (as in grid_getVisible), false if none are or on error.
+ * We guarantee:
+ *   A null grid or array, or invalid player index, is ignored; invalid indices in the array are skipped
+ *   Answers come from a reverse visibility index built at load when one is available
+ * Note
+ *   Used to decide whose view a change to the master grid affects
+ */
+bool grid_canSeeAny(grid_t* grid, int playerIdx, int* cellIdxs, int numCells);
+
+/**************** grid_getNumPiles ****************/
+/* Get the number of gold piles still on the map, or 0 if the grid is null. */
+int grid_getNumPiles(grid_t* grid);
+
+/**************** grid_removePile ****************/
+/* Take a gold pile out of the grid's index of piles, as it's picked up.
+ *
+ * Caller provides
+ *   valid grid, index in grid string of the pile.
+ * We return:
+ *   true if a pile was there and has been removed, false if there was none or error.
+ * We guarantee:
+ *   A null grid or invalid index is ignored
+ *   Takes constant time
+ * Note
+ *   The master grid is left alone; the caller puts whatever now stands there with grid_updateMaster
+ */
+bool grid_removePile(grid_t* grid, int idx);
+
 /**************** grid_playerToGrid ****************/
 /* Calculates a random location and if viable ('.') inserts player at that location.
  *
@@ -113,6 +461,7 @@ char* grid_updatePlayerGrid(grid_t* grid, player_t* player);
  * We guarantee:
  *   A null grid or invalid index provided for either coordinate is ignored 
  *   True is returned if the given pair of coordinates can see one another, false otherwise
+ *   The player's seen bitset starts empty, to be filled in by grid_updatePlayerGrid
  */
 void grid_playerToGrid(grid_t* grid, player_t* player, char letter);
 
@@ -153,6 +502,20 @@ int grid_getNR(grid_t* grid);
  */
 int grid_getNC(grid_t* grid);
 
+/**************** grid_getLength ****************/
+/* Gets the number of characters in the grid string, not counting the terminating null.
+ *
+ * Caller provides
+ *   valid grid pointer.
+ * We guarantee:
+ *   A null grid is ignored 
+ * We return:
+ *   An integer for the length of the master (and original) grid string, or -1 for a null grid
+ * Note
+ *   A buffer for grid_renderPlayerGrid needs one more character than this
+ */
+int grid_getLength(grid_t* grid);
+
 /**************** grid_getMasterGrid ****************/
 /* Gets the master grid string which contains up-to-date information on players, gold, and overall gameplay.
  *
@@ -173,6 +536,22 @@ char* grid_getMasterGrid(grid_t* grid);
  * We guarantee:
  *   A null grid is ignored 
  * We return:
- *   A string with the original contents of the nuggets game's map
+ *   The string with the original contents of the nuggets game's map, or NULL on error
+ * Note:
+ *   The string belongs to the grid, lasting until grid_delete; caller must not free it.
+ *   The grid keeps its original map packed four bits per cell and unpacks it on the first call;
+ *   use grid_getOriginalChar for single characters.
  */
 char* grid_getOriginalGrid(grid_t* grid);
+
+/**************** grid_getOriginalChar ****************/
+/* Gets a single character of the original grid.
+ *
+ * Caller provides
+ *   valid grid pointer, grid index.
+ * We guarantee:
+ *   A null grid or invalid index is ignored 
+ * We return:
+ *   The character of the original map at that index, or '\0' on error
+ */
+char grid_getOriginalChar(grid_t* grid, int idx);
@@ -0,0 +1,725 @@
+/*
+ * gridfuzz.c - differential fuzzer and benchmark for grid's visibility engines
+ *
+ * Every visibility engine, with vector and with scalar rays and with the
+ * terrain laid out row by row and in tiles, and with views swept rather
+ * than cast through rooms, is checked against
+ * grid_isVisiblePoint for every pair of a spot players can stand on and a
+ * cell of the map: the view grid_getVisible gives and the answer of
+ * grid_canSeeAny must both agree with it. grid_isVisiblePoint shares code
+ * with the engines, so it's checked in turn against a line walk of our own
+ * over the map's characters (see walkLine). Maps are generated at random
+ * (rooms of every shape, passages and scattered walls, with and without a
+ * light radius), and any map files given are checked too. The first
+ * mismatch is reported with the map shrunk as far as it still shows it, and
+ * at the end the time each engine took is reported.
+ *
+ * usage: gridfuzz [-n numRandomMaps] [-s seed] [map.txt ...]
+ *
+ * Exits 0 if every engine agreed on every map, 1 on a mismatch, 2 on error.
+ */
+
+#define _POSIX_C_SOURCE 200809L  // clock_gettime
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include "grid.h"
+
+/**************** file-local global variables ****************/
+static const char* MapFile = "./gridfuzz-map.txt";  // where each map is written for grid_initialize
+static const int MinRows = 5;  // size of random maps
+static const int MaxRows = 40;
+static const int MinColumns = 5;
+static const int MaxColumns = 80;
+static const int MaxShrinkTries = 4000;  // map rebuilds allowed while shrinking a mismatch
+
+// One engine, with vector or scalar rays over row-by-row or tiled terrain, views cast through rooms or swept,
+// and the time it took on every map so far
+typedef struct engineRun {
+  const char* engine;
+  bool vectorRays;
+  bool tiledTerrain;
+  bool sweepViews;  // room culling off (see grid_setRoomCulling)
+  double buildSeconds;  // building it at load
+  double viewSeconds;  // grid_getVisible from every spot players can stand on
+  double lookupSeconds;  // grid_canSeeAny for every pair
+  long numViews;
+  long numLookups;
+} engineRun_t;
+
+// A map held as rows of characters, each row without its newline
+typedef struct map {
+  int numRows;
+  int numColumns;
+  char* cells;  // numRows * numColumns characters
+} map_t;
+
+// Where an engine disagreed with grid_isVisiblePoint
+typedef struct mismatch {
+  int viewer;  // grid index of the spot looked from, in a map with newlines
+  int target;  // grid index of the cell looked at
+  char viewChar;  // what grid_getVisible showed at the target
+  char expectedChar;  // and what it should have
+  bool canSee;  // what grid_canSeeAny said
+  bool isVisible;  // and what grid_isVisiblePoint said
+  bool walkSees;  // and what walkLine said
+} mismatch_t;
+
+/************** local functions ***********/
+static int checkMap(map_t* map, engineRun_t* runs, int numRuns, int lightRadius, int viewer, int target,
+                    mismatch_t* mismatch, int* failedRun);
+static bool checkPair(grid_t* grid, char* view, int viewer, int target, bool isVisible, mismatch_t* mismatch);
+static bool walkLine(map_t* map, int lightRadius, int viewerRow, int viewerCol, int targetRow, int targetCol);
+static bool blocksSight(map_t* map, int row, int col);
+static int stillFails(map_t* map, engineRun_t* run, int lightRadius, int viewerRow, int viewerCol, int targetRow, int targetCol);
+static void shrinkMap(map_t* map, engineRun_t* run, int lightRadius, int* viewerRow, int* viewerCol, int* targetRow, int* targetCol);
+static void reportMismatch(map_t* map, engineRun_t* run, int lightRadius, mismatch_t* mismatch, const char* source);
+static map_t* randomMap(void);
+static void drawRoom(map_t* map, int top, int left, int bottom, int right, bool interior);
+static void drawPassage(map_t* map, int fromRow, int fromCol, int toRow, int toCol);
+static map_t* readMap(const char* path);
+static bool writeMap(map_t* map);
+static map_t* copyMap(map_t* map);
+static void deleteMap(map_t* map);
+static double secondsSince(struct timespec* start);
+
+int
+main(const int argc, char* argv[])
+{
+  int numRandomMaps = 200;
+  unsigned int seed = time(NULL);
+  int firstPath = 1;
+  while (firstPath + 1 < argc && argv[firstPath][0] == '-') {
+    if (strcmp(argv[firstPath], "-n") == 0 && sscanf(argv[firstPath + 1], "%d", &numRandomMaps) == 1 && numRandomMaps >= 0) {
+      firstPath += 2;
+    }
+    else if (strcmp(argv[firstPath], "-s") == 0 && sscanf(argv[firstPath + 1], "%u", &seed) == 1) {
+      firstPath += 2;
+    }
+    else {
+      fprintf(stderr, "usage: %s [-n numRandomMaps] [-s seed] [map.txt ...]\n", argv[0]);
+      return 2;
+    }
+  }
+  printf("Checking %d random maps (seed %u) and %d map file(s).\n", numRandomMaps, seed, argc - firstPath);
+  srand(seed);
+
+  engineRun_t runs[] = {
+    {"table", true, false}, {"runs", true, false}, {"cache", true, false}, {"rays", true, false},
+    {"table", false, false}, {"runs", false, false}, {"cache", false, false}, {"rays", false, false},
+    {"table", true, true}, {"runs", true, true}, {"cache", true, true}, {"rays", true, true},
+    {"table", false, true}, {"runs", false, true}, {"cache", false, true}, {"rays", false, true},
+    {"table", true, false, true}, {"runs", true, false, true}, {"cache", true, false, true}, {"rays", true, false, true},
+  };
+  int numRuns = sizeof(runs) / sizeof(runs[0]);
+  int numChecked = 0;
+  for (int m = 0; m < numRandomMaps + argc - firstPath; m++) {
+    map_t* map;
+    char source[64];
+    int lightRadius = 0;
+    if (m < numRandomMaps) {
+      map = randomMap();
+      lightRadius = (rand() % 4 == 0) ? 1 + rand() % 8 : 0;  // a light radius now and then
+      snprintf(source, sizeof(source), "random map %d", m);
+    }
+    else {
+      const char* path = argv[firstPath + m - numRandomMaps];
+      if ((map = readMap(path)) == NULL) {
+        continue;  // not a valid map, already reported
+      }
+      snprintf(source, sizeof(source), "%.63s", path);
+    }
+    if (map == NULL) {
+      fprintf(stderr, "gridfuzz: error allocating memory for map\n");
+      return 2;
+    }
+    mismatch_t mismatch;
+    int failedRun;
+    int result = checkMap(map, runs, numRuns, lightRadius, -1, -1, &mismatch, &failedRun);
+    if (result < 0) {
+      deleteMap(map);
+      return 2;
+    }
+    if (result > 0) {
+      reportMismatch(map, (failedRun >= 0) ? &runs[failedRun] : NULL, lightRadius, &mismatch, source);
+      deleteMap(map);
+      remove(MapFile);
+      return 1;
+    }
+    deleteMap(map);
+    numChecked++;
+  }
+  remove(MapFile);
+  grid_setEngine(NULL);
+  grid_setVectorRays(true);
+  grid_setTiledTerrain(false);
+  grid_setRoomCulling(true);
+  grid_setDefaultLightRadius(0);
+
+  printf("All engines agree with grid_isVisiblePoint, and it with the line walk, on %d map(s).\n\n", numChecked);
+  printf("%-6s %-6s %-7s %-5s %10s %10s %12s %14s\n", "engine", "rays", "terrain", "cast", "build (s)", "views (s)",
+         "lookups (s)", "views/second");
+  for (int r = 0; r < numRuns; r++) {
+    double viewRate = (runs[r].viewSeconds > 0) ? runs[r].numViews / runs[r].viewSeconds : 0;
+    printf("%-6s %-6s %-7s %-5s %10.3f %10.3f %12.3f %14.0f\n", runs[r].engine, runs[r].vectorRays ? "vector" : "scalar",
+           runs[r].tiledTerrain ? "tiled" : "rows", runs[r].sweepViews ? "sweep" : "rooms",
+           runs[r].buildSeconds, runs[r].viewSeconds, runs[r].lookupSeconds, viewRate);
+  }
+  return 0;
+}
+
+/*************** checkMap() *************/
+/* Load map once with each engine in runs and compare their answers with
+ * grid_isVisiblePoint, worked out once for each viewer and checked against
+ * walkLine first: every pair of a spot players can stand on and a cell, or
+ * only the pair (viewer, target) if both are given (>= 0). Times the engines
+ * unless just checking a pair. Returns 1 on the first mismatch, filling in
+ * mismatch and the index in runs of the engine that got it wrong (-1 if it
+ * was grid_isVisiblePoint); 0 if none; -1 on error.
+ */
+static int
+checkMap(map_t* map, engineRun_t* runs, int numRuns, int lightRadius, int viewer, int target,
+         mismatch_t* mismatch, int* failedRun)
+{
+  if (!writeMap(map)) {
+    return -1;
+  }
+  bool timed = viewer < 0;
+  grid_t* grids[numRuns];
+  for (int r = 0; r < numRuns; r++) {
+    grid_setEngine(runs[r].engine);
+    grid_setVectorRays(runs[r].vectorRays);
+    grid_setTiledTerrain(runs[r].tiledTerrain);
+    grid_setRoomCulling(!runs[r].sweepViews);
+    grid_setDefaultLightRadius(lightRadius);  // tables built for the radius, as the server builds them
+    int numPiles;
+    grids[r] = grid_initialize((char*)MapFile, 0, 0, &numPiles);  // no gold, so views show the original map
+    if (grids[r] == NULL) {
+      if (timed) {
+        fprintf(stderr, "gridfuzz: error loading map\n");  // maps tried while shrinking may not load
+      }
+      for (int k = 0; k < r; k++) {
+        grid_delete(grids[k]);
+      }
+      return -1;
+    }
+    int numThreads;
+    double buildSeconds;
+    long memoryBytes;
+    if (timed && grid_getBuildStats(grids[r], &numThreads, &buildSeconds, &memoryBytes)) {
+      runs[r].buildSeconds += buildSeconds;
+    }
+  }
+
+  int gridLength = grid_getLength(grids[0]);
+  int firstViewer = timed ? 0 : viewer;
+  int lastViewer = timed ? gridLength - 1 : viewer;
+  int firstTarget = timed ? 0 : target;
+  int lastTarget = timed ? gridLength - 1 : target;
+  bool* isVisible = calloc(gridLength, sizeof(bool));
+  int result = (isVisible == NULL) ? -1 : 0;
+  for (int v = firstViewer; v <= lastViewer && result == 0; v++) {
+    char viewerChar = grid_getOriginalChar(grids[0], v);
+    if (viewerChar != '.' && viewerChar != '#') {
+      continue;  // players only stand on room spots and passages
+    }
+    int numColumns = map->numColumns + 1;  // grid indices count the newline
+    for (int t = firstTarget; t <= lastTarget; t++) {
+      isVisible[t] = t == v || grid_isVisiblePoint(grids[0], t, v);
+      if (t % numColumns == map->numColumns) {
+        continue;  // a newline, not a cell
+      }
+      bool walkSees = walkLine(map, lightRadius, v / numColumns, v % numColumns, t / numColumns, t % numColumns);
+      if (walkSees != isVisible[t]) {
+        *mismatch = (mismatch_t){v, t, ' ', ' ', false, isVisible[t], walkSees};
+        *failedRun = -1;
+        result = 1;
+        break;
+      }
+    }
+    for (int r = 0; r < numRuns && result == 0; r++) {
+      struct timespec start;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      char* view = grid_getVisible(grids[r], v);
+      if (view == NULL) {
+        result = -1;
+        break;
+      }
+      if (timed) {
+        runs[r].viewSeconds += secondsSince(&start);
+        runs[r].numViews++;
+        // Time the lookups on their own, then check them along with the view
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int t = 0; t < gridLength; t++) {
+          grid_canSeeAny(grids[r], v, &t, 1);
+        }
+        runs[r].lookupSeconds += secondsSince(&start);
+        runs[r].numLookups += gridLength;
+      }
+      for (int t = firstTarget; t <= lastTarget; t++) {
+        if (!checkPair(grids[r], view, v, t, isVisible[t], mismatch)) {
+          *failedRun = r;
+          result = 1;
+          break;
+        }
+      }
+      free(view);
+    }
+  }
+  free(isVisible);
+  for (int r = 0; r < numRuns; r++) {
+    grid_delete(grids[r]);
+  }
+  return result;
+}
+
+/*************** checkPair() *************/
+/* Check what an engine says about target, seen from viewer, against what
+ * grid_isVisiblePoint says. Returns false and fills in mismatch if they
+ * differ.
+ */
+static bool
+checkPair(grid_t* grid, char* view, int viewer, int target, bool isVisible, mismatch_t* mismatch)
+{
+  char targetChar = grid_getOriginalChar(grid, target);
+  if (targetChar == '\n') {
+    return true;  // not a cell
+  }
+  char expectedChar = (target == viewer) ? '@' : (isVisible ? targetChar : ' ');
+  bool canSee = grid_canSeeAny(grid, viewer, &target, 1);
+  if (view[target] == expectedChar && canSee == isVisible) {
+    return true;
+  }
+  *mismatch = (mismatch_t){viewer, target, view[target], expectedChar, canSee, isVisible, isVisible};
+  return false;
+}
+
+/*************** walkLine() *************/
+/* Our own answer to whether the cell at (targetRow, targetCol) can be seen
+ * from (viewerRow, viewerCol), worked out from the map's characters alone.
+ * Outside the light radius nothing is seen. A passage more than a step away
+ * is only seen if at most one of its four neighbors is a passage. Otherwise
+ * the line between the two is walked from the lower one, a column at a time,
+ * its height at each column found exactly as a whole number of rows and a
+ * remainder. Where it lands on a cell, that cell blocks it if it blocks
+ * sight; where it passes between two cells of a column, both must. Each row
+ * it rises into between two columns is blocked if the cells either side of
+ * the crossing both block, except the crossing right beside the lower one.
+ * A line straight up or down is blocked by any cell between the two.
+ */
+static bool
+walkLine(map_t* map, int lightRadius, int viewerRow, int viewerCol, int targetRow, int targetCol)
+{
+  int rowDist = targetRow - viewerRow;
+  int colDist = targetCol - viewerCol;
+  if (rowDist == 0 && colDist == 0) {
+    return true;
+  }
+  if (lightRadius > 0 && rowDist * rowDist + colDist * colDist > lightRadius * lightRadius) {
+    return false;
+  }
+  if (map->cells[targetRow * map->numColumns + targetCol] == '#' && (abs(rowDist) > 1 || abs(colDist) > 1)) {
+    int numPassages = 0;
+    int neighbors[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+    for (int n = 0; n < 4; n++) {
+      int row = targetRow + neighbors[n][0];
+      int col = targetCol + neighbors[n][1];
+      if (row >= 0 && row < map->numRows && col >= 0 && col < map->numColumns
+          && map->cells[row * map->numColumns + col] == '#') {
+        numPassages++;
+      }
+    }
+    if (numPassages > 1) {
+      return false;
+    }
+  }
+
+  // Walk up from the lower point (the target if they share a row), mirrored when the line runs left
+  bool fromTarget = targetRow >= viewerRow;
+  int lowRow = fromTarget ? targetRow : viewerRow;
+  int lowCol = fromTarget ? targetCol : viewerCol;
+  int rise = abs(rowDist);
+  int run = abs(colDist);
+  int side = ((fromTarget ? -colDist : colDist) >= 0) ? 1 : -1;
+  if (run == 0) {
+    for (int up = 1; up < rise; up++) {
+      if (blocksSight(map, lowRow - up, lowCol)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  int lastTop = 0;  // row, counted up from the lower point, at or just above the line in the last column
+  for (int across = 1; across <= run; across++) {
+    int rows = across * rise / run;
+    bool onCell = across * rise % run == 0;
+    int top = onCell ? rows : rows + 1;
+    int col = lowCol + side * across;
+    if (across < run && blocksSight(map, lowRow - top, col) && blocksSight(map, lowRow - (onCell ? top : top - 1), col)) {
+      return false;
+    }
+    for (int up = lastTop; up < top; up++) {
+      if ((across > 1 || up > 0) && blocksSight(map, lowRow - up, col) && blocksSight(map, lowRow - up, col - side)) {
+        return false;
+      }
+    }
+    lastTop = top;
+  }
+  return true;
+}
+
+/*************** blocksSight() *************/
+/* Return true if the map's character at (row, col) blocks sight: anything
+ * but a room spot.
+ */
+static bool
+blocksSight(map_t* map, int row, int col)
+{
+  return map->cells[row * map->numColumns + col] != '.';
+}
+
+/*************** stillFails() *************/
+/* Return 1 if the engine (grid_isVisiblePoint if run is NULL) still gets the
+ * given pair on map wrong, 0 if not, -1 on error.
+ */
+static int
+stillFails(map_t* map, engineRun_t* run, int lightRadius, int viewerRow, int viewerCol, int targetRow, int targetCol)
+{
+  int numColumns = map->numColumns + 1;  // grid indices count the newline
+  engineRun_t anyEngine = {"table", true, false, false};  // just to load the map; grid_isVisiblePoint is the same on all
+  mismatch_t mismatch;
+  int failedRun;
+  int result = checkMap(map, (run != NULL) ? run : &anyEngine, 1, lightRadius, viewerRow * numColumns + viewerCol,
+                        targetRow * numColumns + targetCol, &mismatch, &failedRun);
+  if (result == 1 && (run == NULL) != (failedRun < 0)) {
+    return 0;  // only the other check fails now
+  }
+  return result;
+}
+
+/*************** shrinkMap() *************/
+/* Shrink a map an engine gets a pair wrong on, for as long as it still gets
+ * it wrong: drop whole rows and columns the pair isn't in, then turn single
+ * cells into rock, until nothing more can go or MaxShrinkTries maps have
+ * been tried. Updates the pair's coordinates as rows and columns go.
+ */
+static void
+shrinkMap(map_t* map, engineRun_t* run, int lightRadius, int* viewerRow, int* viewerCol, int* targetRow, int* targetCol)
+{
+  int numTries = 0;
+  bool shrunk = true;
+  while (shrunk && numTries < MaxShrinkTries) {
+    shrunk = false;
+    // Rows, then columns
+    for (int r = map->numRows - 1; r >= 0 && numTries < MaxShrinkTries; r--) {
+      if (r == *viewerRow || r == *targetRow || map->numRows <= 2) {  // grid_initialize needs two lines
+        continue;
+      }
+      map_t* trial = copyMap(map);
+      if (trial == NULL) {
+        return;
+      }
+      memmove(trial->cells + r * trial->numColumns, trial->cells + (r + 1) * trial->numColumns,
+              (trial->numRows - r - 1) * trial->numColumns);
+      trial->numRows--;
+      int newViewerRow = *viewerRow - (*viewerRow > r);
+      int newTargetRow = *targetRow - (*targetRow > r);
+      numTries++;
+      if (stillFails(trial, run, lightRadius, newViewerRow, *viewerCol, newTargetRow, *targetCol) == 1) {
+        free(map->cells);
+        *map = *trial;
+        free(trial);
+        *viewerRow = newViewerRow;
+        *targetRow = newTargetRow;
+        shrunk = true;
+      }
+      else {
+        deleteMap(trial);
+      }
+    }
+    for (int c = map->numColumns - 1; c >= 0 && numTries < MaxShrinkTries; c--) {
+      if (c == *viewerCol || c == *targetCol || map->numColumns <= 1) {
+        continue;
+      }
+      map_t* trial = copyMap(map);
+      if (trial == NULL) {
+        return;
+      }
+      int newColumns = map->numColumns - 1;
+      for (int r = 0; r < map->numRows; r++) {
+        for (int k = 0; k < newColumns; k++) {
+          trial->cells[r * newColumns + k] = map->cells[r * map->numColumns + k + (k >= c)];
+        }
+      }
+      trial->numColumns = newColumns;
+      int newViewerCol = *viewerCol - (*viewerCol > c);
+      int newTargetCol = *targetCol - (*targetCol > c);
+      numTries++;
+      if (stillFails(trial, run, lightRadius, *viewerRow, newViewerCol, *targetRow, newTargetCol) == 1) {
+        free(map->cells);
+        *map = *trial;
+        free(trial);
+        *viewerCol = newViewerCol;
+        *targetCol = newTargetCol;
+        shrunk = true;
+      }
+      else {
+        deleteMap(trial);
+      }
+    }
+    // Then single cells
+    for (int i = 0; i < map->numRows * map->numColumns && numTries < MaxShrinkTries; i++) {
+      int r = i / map->numColumns;
+      int c = i % map->numColumns;
+      if (map->cells[i] == ' ' || (r == *viewerRow && c == *viewerCol) || (r == *targetRow && c == *targetCol)) {
+        continue;
+      }
+      char cell = map->cells[i];
+      map->cells[i] = ' ';
+      numTries++;
+      if (stillFails(map, run, lightRadius, *viewerRow, *viewerCol, *targetRow, *targetCol) == 1) {
+        shrunk = true;
+      }
+      else {
+        map->cells[i] = cell;
+      }
+    }
+  }
+}
+
+/*************** reportMismatch() *************/
+/* Print a mismatch, of the given engine or of grid_isVisiblePoint if run is
+ * NULL, then shrink the map and print it with the viewer marked 'V' and the
+ * target 'T'.
+ */
+static void
+reportMismatch(map_t* map, engineRun_t* run, int lightRadius, mismatch_t* mismatch, const char* source)
+{
+  int numColumns = map->numColumns + 1;
+  int viewerRow = mismatch->viewer / numColumns;
+  int viewerCol = mismatch->viewer % numColumns;
+  int targetRow = mismatch->target / numColumns;
+  int targetCol = mismatch->target % numColumns;
+  if (run == NULL) {
+    printf("MISMATCH on %s: grid_isVisiblePoint against gridfuzz's own line walk, light radius %d\n", source, lightRadius);
+    printf("From (%d, %d) to (%d, %d): grid_isVisiblePoint says %s, the line walk says %s\n",
+           viewerRow, viewerCol, targetRow, targetCol, mismatch->isVisible ? "visible" : "not visible",
+           mismatch->walkSees ? "visible" : "not visible");
+  }
+  else {
+    printf("MISMATCH on %s: engine %s with %s rays over %s terrain, views %s, light radius %d\n", source, run->engine,
+           run->vectorRays ? "vector" : "scalar", run->tiledTerrain ? "tiled" : "row-by-row",
+           run->sweepViews ? "swept" : "cast through rooms", lightRadius);
+    printf("From (%d, %d) to (%d, %d): view shows '%c' where '%c' belongs, grid_canSeeAny says %s, grid_isVisiblePoint says %s\n",
+           viewerRow, viewerCol, targetRow, targetCol, mismatch->viewChar, mismatch->expectedChar,
+           mismatch->canSee ? "visible" : "not visible", mismatch->isVisible ? "visible" : "not visible");
+  }
+  shrinkMap(map, run, lightRadius, &viewerRow, &viewerCol, &targetRow, &targetCol);
+  printf("Smallest map found that still shows it (V from, T to), %d x %d:\n", map->numRows, map->numColumns);
+  for (int r = 0; r < map->numRows; r++) {
+    for (int c = 0; c < map->numColumns; c++) {
+      bool isViewer = r == viewerRow && c == viewerCol;
+      bool isTarget = r == targetRow && c == targetCol;
+      putchar(isViewer ? 'V' : isTarget ? 'T' : map->cells[r * map->numColumns + c]);
+    }
+    putchar('\n');
+  }
+}
+
+/*************** randomMap() *************/
+/* Make a random map: rooms whose borders are drawn before any interiors, so
+ * overlapping ones merge into rooms of other shapes; passages joining them,
+ * cutting doorways in the walls; and sometimes walls, corners, passages and
+ * rock scattered around. Returns NULL on allocation error.
+ */
+static map_t*
+randomMap(void)
+{
+  map_t* map = malloc(sizeof(map_t));
+  if (map == NULL) {
+    return NULL;
+  }
+  map->numRows = MinRows + rand() % (MaxRows - MinRows + 1);
+  map->numColumns = MinColumns + rand() % (MaxColumns - MinColumns + 1);
+  map->cells = malloc(map->numRows * map->numColumns);
+  if (map->cells == NULL) {
+    free(map);
+    return NULL;
+  }
+  memset(map->cells, ' ', map->numRows * map->numColumns);
+
+  int numRooms = 1 + rand() % 6;
+  int rooms[6][4];  // top, left, bottom, right
+  for (int i = 0; i < numRooms; i++) {
+    rooms[i][0] = rand() % (map->numRows - 2);
+    rooms[i][1] = rand() % (map->numColumns - 2);
+    rooms[i][2] = rooms[i][0] + 2 + rand() % (map->numRows - rooms[i][0] - 2);
+    rooms[i][3] = rooms[i][1] + 2 + rand() % (map->numColumns - rooms[i][1] - 2);
+    drawRoom(map, rooms[i][0], rooms[i][1], rooms[i][2], rooms[i][3], false);
+  }
+  for (int i = 0; i < numRooms; i++) {
+    drawRoom(map, rooms[i][0], rooms[i][1], rooms[i][2], rooms[i][3], true);
+  }
+  for (int i = 1; i < numRooms; i++) {
+    drawPassage(map, (rooms[i - 1][0] + rooms[i - 1][2]) / 2, (rooms[i - 1][1] + rooms[i - 1][3]) / 2,
+                (rooms[i][0] + rooms[i][2]) / 2, (rooms[i][1] + rooms[i][3]) / 2);
+  }
+  if (rand() % 2 == 0) {
+    int numScattered = rand() % (map->numRows * map->numColumns / 8 + 1);
+    for (int i = 0; i < numScattered; i++) {
+      map->cells[rand() % (map->numRows * map->numColumns)] = "-|+# ."[rand() % 6];
+    }
+  }
+  return map;
+}
+
+/*************** drawRoom() *************/
+/* Draw a room's border (corners and walls) or its interior (room spots). */
+static void
+drawRoom(map_t* map, int top, int left, int bottom, int right, bool interior)
+{
+  for (int r = top; r <= bottom; r++) {
+    for (int c = left; c <= right; c++) {
+      bool isRowEdge = r == top || r == bottom;
+      bool isColEdge = c == left || c == right;
+      if (interior && !isRowEdge && !isColEdge) {
+        map->cells[r * map->numColumns + c] = '.';
+      }
+      else if (!interior && (isRowEdge || isColEdge)) {
+        map->cells[r * map->numColumns + c] = (isRowEdge && isColEdge) ? '+' : (isRowEdge ? '-' : '|');
+      }
+    }
+  }
+}
+
+/*************** drawPassage() *************/
+/* Draw an L-shaped passage between two points, across rows then down
+ * columns, leaving room spots alone and turning anything else into '#'.
+ */
+static void
+drawPassage(map_t* map, int fromRow, int fromCol, int toRow, int toCol)
+{
+  int r = fromRow;
+  int c = fromCol;
+  while (true) {
+    char* cell = &map->cells[r * map->numColumns + c];
+    if (*cell != '.') {
+      *cell = '#';
+    }
+    if (c != toCol) {
+      c += (toCol > c) ? 1 : -1;
+    }
+    else if (r != toRow) {
+      r += (toRow > r) ? 1 : -1;
+    }
+    else {
+      break;
+    }
+  }
+}
+
+/*************** readMap() *************/
+/* Read a map file, checking every line has the same width and ends in a
+ * newline. Returns NULL, saying why, if it isn't a valid map or on error.
+ */
+static map_t*
+readMap(const char* path)
+{
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    fprintf(stderr, "gridfuzz: can't read %s, skipping it\n", path);
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  rewind(file);
+  char* text = malloc(size + 1);
+  map_t* map = malloc(sizeof(map_t));
+  if (text == NULL || map == NULL || fread(text, 1, size, file) != size) {
+    fprintf(stderr, "gridfuzz: error reading %s, skipping it\n", path);
+    fclose(file);
+    free(text);
+    free(map);
+    return NULL;
+  }
+  fclose(file);
+  char* firstNewline = memchr(text, '\n', size);
+  map->numColumns = (firstNewline != NULL) ? firstNewline - text : 0;
+  map->numRows = (map->numColumns > 0) ? size / (map->numColumns + 1) : 0;
+  bool isValid = map->numRows > 0 && size == (long)map->numRows * (map->numColumns + 1);
+  for (int r = 0; r < map->numRows && isValid; r++) {
+    isValid = text[r * (map->numColumns + 1) + map->numColumns] == '\n'
+              && memchr(text + r * (map->numColumns + 1), '\n', map->numColumns) == NULL;
+  }
+  if (!isValid) {
+    fprintf(stderr, "gridfuzz: %s has lines of different widths or no final newline, skipping it\n", path);
+    free(text);
+    free(map);
+    return NULL;
+  }
+  map->cells = text;
+  for (int r = 0; r < map->numRows; r++) {
+    memmove(map->cells + r * map->numColumns, text + r * (map->numColumns + 1), map->numColumns);
+  }
+  return map;
+}
+
+/*************** writeMap() *************/
+/* Write a map to MapFile, each row followed by a newline. */
+static bool
+writeMap(map_t* map)
+{
+  FILE* file = fopen(MapFile, "w");
+  if (file == NULL) {
+    fprintf(stderr, "gridfuzz: can't write %s\n", MapFile);
+    return false;
+  }
+  for (int r = 0; r < map->numRows; r++) {
+    fwrite(map->cells + r * map->numColumns, 1, map->numColumns, file);
+    fputc('\n', file);
+  }
+  fclose(file);
+  return true;
+}
+
+/*************** copyMap() *************/
+/* Return a new copy of a map, or NULL on allocation error. */
+static map_t*
+copyMap(map_t* map)
+{
+  map_t* copy = malloc(sizeof(map_t));
+  if (copy == NULL) {
+    return NULL;
+  }
+  *copy = *map;
+  copy->cells = malloc(map->numRows * map->numColumns);
+  if (copy->cells == NULL) {
+    free(copy);
+    return NULL;
+  }
+  memcpy(copy->cells, map->cells, map->numRows * map->numColumns);
+  return copy;
+}
+
+/*************** deleteMap() *************/
+/* Free a map; a NULL map is ignored. */
+static void
+deleteMap(map_t* map)
+{
+  if (map != NULL) {
+    free(map->cells);
+    free(map);
+  }
+}
+
+/*************** secondsSince() *************/
+/* Return the wall-clock seconds since start. */
+static double
+secondsSince(struct timespec* start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
@@ -7,8 +7,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include "grid.h"
 #include "player.h"
+#include "message.h"
+
+static int countDifferingViews(grid_t* grid, grid_t* otherGrid);
+static void printSightFingerprint(const char* mapFile);
 
 int 
 main() 
@@ -43,6 +48,16 @@ main()
   printf("\n\nOriginal grid saved without gold...\n");
   char* originalGrid = grid_getOriginalGrid(grid);
   printf("%s\n", originalGrid);
+  printf("Test getOriginalChar agrees with getOriginalGrid for every index:\n");
+  for (int i = 0; i < grid_getLength(grid); i++) {
+    if (grid_getOriginalChar(grid, i) != originalGrid[i]) {
+      fprintf(stderr, "getOriginalChar and getOriginalGrid disagree at index %d.\n", i);
+      return 1;
+    }
+  }
+  printf("getOriginalChar agrees with getOriginalGrid.\n");
+  printf("Test getOriginalChar with invalid index: %s\n",
+         grid_getOriginalChar(grid, grid_getLength(grid)) == '\0' ? "ignored" : "not ignored");
 
 
   printf("\nTest update master with NULL grid, valid index, and valid character...\n");
@@ -70,6 +85,19 @@ main()
 
   printf("\nGot visible grid:\n");
   printf("%s\n", visibleGrid);
+
+  printf("Test getVisible agrees with isVisiblePoint for every index:\n");
+  char* master = grid_getMasterGrid(grid);
+  for (int i = 0; i < strlen(master); i++) {
+    if (i == 1145 || master[i] == ' ' || master[i] == '\n') {
+      continue;  // player's own spot and blank characters look the same either way
+    }
+    if (grid_isVisiblePoint(grid, i, 1145) != (visibleGrid[i] == master[i])) {
+      fprintf(stderr, "getVisible and isVisiblePoint disagree at index %d.\n", i);
+      return 1;
+    }
+  }
+  printf("getVisible agrees with isVisiblePoint.\n");
   free(visibleGrid);
 
   printf("Test isVisiblePoint with invisible point:\n");
@@ -88,6 +116,127 @@ main()
   }
   printf("Correctly determined point is visible.\n");
 
+  printf("\nTest canSeeAny with NULL grid:\n");
+  int seenIdxs[] = {15, 1145};
+  if (grid_canSeeAny(NULL, 1157, seenIdxs, 2)) {
+    fprintf(stderr, "canSeeAny accepted a NULL grid.\n");
+    return 1;
+  }
+  printf("Test canSeeAny with player's own index:\n");
+  int ownIdx[] = {1157};
+  if (!grid_canSeeAny(grid, 1157, ownIdx, 1)) {
+    fprintf(stderr, "failed to see player's own index.\n");
+    return 1;
+  }
+  printf("Test canSeeAny with only an invisible point:\n");
+  if (grid_canSeeAny(grid, 1157, seenIdxs, 1)) {
+    fprintf(stderr, "failed to determine no point was visible.\n");
+    return 1;
+  }
+  printf("Test canSeeAny with an invisible and a visible point:\n");
+  if (!grid_canSeeAny(grid, 1157, seenIdxs, 2)) {
+    fprintf(stderr, "failed to determine a point was visible.\n");
+    return 1;
+  }
+  printf("canSeeAny agrees with isVisiblePoint.\n");
+
+  printf("\nTest gold pile index against the master grid:\n");
+  int numGold = 0;
+  int firstPileIdx = -1;
+  for (int i = 0; i < grid_getLength(grid); i++) {
+    if (masterGridString[i] == '*') {
+      firstPileIdx = (numGold++ == 0) ? i : firstPileIdx;
+    }
+  }
+  if (grid_getNumPiles(grid) != numGold) {
+    fprintf(stderr, "gold index holds %d piles, master grid %d.\n", grid_getNumPiles(grid), numGold);
+    return 1;
+  }
+  printf("Index holds all %d piles.\n", numGold);
+  bool firstRemoval = grid_removePile(grid, firstPileIdx);
+  bool secondRemoval = grid_removePile(grid, firstPileIdx);
+  printf("Test removing pile at %d twice: %s, then %s\n", firstPileIdx,
+         firstRemoval ? "removed" : "not removed", secondRemoval ? "removed" : "not removed");
+  printf("Piles left: %d\n", grid_getNumPiles(grid));
+  printf("Test removePile on a spot without a pile: %s\n", grid_removePile(grid, 1157) ? "removed" : "not removed");
+
+  printf("\nTest master grid versions:\n");
+  long startVersion = grid_getVersion(grid);
+  grid_updateMaster(grid, 1146, 'B');
+  grid_updateMaster(grid, 1145, 'A');  // already there, so not a change
+  grid_updateMaster(grid, 1146, 'C');
+  grid_updateMaster(grid, 1145, '!');
+  int changedIdxs[4];
+  int numChanged = grid_getChangesSince(grid, startVersion, changedIdxs, 4);
+  printf("%ld changes since version %ld, to %d spot(s):", grid_getVersion(grid) - startVersion, startVersion, numChanged);
+  for (int i = 0; i < numChanged && i < 4; i++) {
+    printf(" %d", changedIdxs[i]);
+  }
+  printf("\nRow %d changed: %s, row 0 changed: %s\n", 1145 / grid_getNC(grid),
+         grid_rowChangedSince(grid, 1145 / grid_getNC(grid), startVersion) ? "yes" : "no",
+         grid_rowChangedSince(grid, 0, startVersion) ? "yes" : "no");
+  printf("Test getChangesSince with the current version: %d\n",
+         grid_getChangesSince(grid, grid_getVersion(grid), NULL, 0));
+  printf("Test getChangesSince with a version from the future: %d\n",
+         grid_getChangesSince(grid, grid_getVersion(grid) + 1, NULL, 0));
+  for (int i = 0; i < 5000; i++) {
+    grid_updateMaster(grid, 1146, (i % 2 == 0) ? 'B' : '!');  // more changes than are remembered
+  }
+  grid_updateMaster(grid, 1145, 'A');
+  printf("Test getChangesSince with a version too old to remember: %d\n",
+         grid_getChangesSince(grid, startVersion, NULL, 0));
+  printf("Row %d still changed: %s\n", 1145 / grid_getNC(grid),
+         grid_rowChangedSince(grid, 1145 / grid_getNC(grid), startVersion) ? "yes" : "no");
+
+  printf("\nTest regions:\n");
+  int numRooms = 0, numDoorways = 0, numSegments = 0;
+  for (int r = 0; r < grid_getNumRegions(grid); r++) {
+    regionType_t type;
+    grid_getRegionInfo(grid, r, &type, NULL, NULL, NULL, NULL, NULL);
+    numRooms += (type == RoomRegion);
+    numDoorways += (type == DoorwayRegion);
+    numSegments += (type == PassageRegion);
+  }
+  printf("Found %d rooms, %d doorways and %d passage segments.\n", numRooms, numDoorways, numSegments);
+  int playerRegion = grid_getRegion(grid, 1145);
+  int minRow, minCol, maxRow, maxCol;
+  bool isRect;
+  grid_getRegionInfo(grid, playerRegion, NULL, &minRow, &minCol, &maxRow, &maxCol, &isRect);
+  const int* neighbors;
+  int numNeighbors = grid_getRegionNeighbors(grid, playerRegion, &neighbors);
+  printf("Index 1145 is in region %d, rows %d-%d, columns %d-%d, %srectangular, with %d neighbor(s).\n",
+         playerRegion, minRow, maxRow, minCol, maxCol, isRect ? "" : "not ", numNeighbors);
+  for (int n = 0; n < numNeighbors; n++) {
+    regionType_t type;
+    grid_getRegionInfo(grid, neighbors[n], &type, NULL, NULL, NULL, NULL, NULL);
+    if (type != DoorwayRegion) {
+      fprintf(stderr, "room's neighbor %d isn't a doorway.\n", neighbors[n]);
+      return 1;
+    }
+  }
+  printf("Test getRegion with a wall index:\n");
+  if (grid_getRegion(grid, 2) != -1) {
+    fprintf(stderr, "getRegion labeled a wall.\n");
+    return 1;
+  }
+  printf("Walls aren't in any region.\n");
+
+  printf("\nTest setLightRadius with negative radius:\n");
+  if (grid_setLightRadius(grid, -1)) {
+    fprintf(stderr, "setLightRadius accepted a negative radius.\n");
+    return 1;
+  }
+  printf("Test isVisiblePoint with a visible point beyond a light radius of 3:\n");
+  grid_setLightRadius(grid, 3);
+  if (grid_isVisiblePoint(grid, 1157, 1145)) {
+    fprintf(stderr, "failed to determine point is out of the light.\n");
+    return 1;
+  }
+  printf("Correctly determined point is out of the light.\n");
+  char* litGrid = grid_getVisible(grid, 1145);
+  printf("Visible grid with a light radius of 3:\n%s\n", litGrid);
+  free(litGrid);
+  grid_setLightRadius(grid, 0);
 
   printf("\nTest updatePlayerGrid with NULL grid, NULL player:\n");
   grid_updatePlayerGrid(NULL, NULL);
@@ -110,19 +259,342 @@ main()
   }
   printf("\nSuccessfully deleted grid.\n");
 
+  printf("\nTest setBuildThreads with negative count:\n");
+  if (grid_setBuildThreads(-1)) {
+    fprintf(stderr, "setBuildThreads accepted a negative count.\n");
+    return 1;
+  }
+  printf("Correctly rejected negative count.\n");
+
   int* secondNumPiles = malloc(sizeof(int));  // pointer to receive number of piles
-  printf("\nTest grid initialization with different map file:\n");
+  printf("\nTest grid initialization with different map file, built on 2 threads:\n");
+  grid_setBuildThreads(2);
   grid_t* secondGrid = grid_initialize("./maps/jello.txt", 10, 30, secondNumPiles);
+  int numThreads;
+  double buildSeconds;
+  long tableBytes;
+  if (!grid_getBuildStats(secondGrid, &numThreads, &buildSeconds, &tableBytes) || numThreads != 2 || tableBytes <= 0) {
+    fprintf(stderr, "failed to build tables on 2 threads.\n");
+    return 1;
+  }
+  printf("Built tables on %d threads, %ld bytes.\n", numThreads, tableBytes);
   char* masterGrid = grid_getMasterGrid(secondGrid);
   printf("New master grid:\n%s\n", masterGrid);
   printf("\nTesting getters:\n");
   printf("Got number of rows: %d\n", grid_getNR(secondGrid));
   printf("Got number of columns: %d\n", grid_getNC(secondGrid));
+  printf("Got grid length: %d\n", grid_getLength(secondGrid));
   printf("Got original grid: \n%s\n", grid_getOriginalGrid(secondGrid));
   printf("Got master grid: \n%s\n", grid_getMasterGrid(secondGrid));
 
+  printf("\nTest compressed visibility table, with a budget too small for the full one:\n");
+  grid_setTableBudget(200000);
+  int runNumPiles;
+  grid_t* runGrid = grid_initialize("./maps/jello.txt", 10, 30, &runNumPiles);
+  grid_setTableBudget(64L * 1024 * 1024);
+  if (!grid_getBuildStats(runGrid, &numThreads, &buildSeconds, &tableBytes) || tableBytes <= 0 || tableBytes > 200000) {
+    fprintf(stderr, "failed to build compressed table.\n");
+    return 1;
+  }
+  printf("Built compressed table, %ld bytes; views differ from the full table at %d spot(s).\n", tableBytes,
+         countDifferingViews(secondGrid, runGrid));
+  grid_delete(runGrid);
+
+  printf("\nTest scalar rays against vector ones:\n");
+  grid_setVectorRays(false);
+  int scalarNumPiles;
+  grid_t* scalarGrid = grid_initialize("./maps/jello.txt", 10, 30, &scalarNumPiles);
+  grid_setTableBudget(0);
+  grid_t* scalarRayGrid = grid_initialize("./maps/jello.txt", 10, 30, &scalarNumPiles);
+  grid_setVectorRays(true);
+  grid_t* vectorRayGrid = grid_initialize("./maps/jello.txt", 10, 30, &scalarNumPiles);
+  grid_setTableBudget(64L * 1024 * 1024);
+  printf("Table built with scalar rays differs from vector at %d spot(s).\n", countDifferingViews(secondGrid, scalarGrid));
+  printf("Views cast with scalar rays differ from vector at %d spot(s).\n", countDifferingViews(vectorRayGrid, scalarRayGrid));
+  grid_delete(scalarGrid);
+  grid_delete(scalarRayGrid);
+  grid_delete(vectorRayGrid);
+
+  printf("\nTest tiled terrain against row by row:\n");
+  grid_setTiledTerrain(true);
+  int tiledNumPiles;
+  grid_t* tiledGrid = grid_initialize("./maps/jello.txt", 10, 30, &tiledNumPiles);
+  grid_setEngine("rays");
+  grid_t* tiledRayGrid = grid_initialize("./maps/jello.txt", 10, 30, &tiledNumPiles);
+  grid_setVectorRays(false);
+  grid_t* tiledScalarGrid = grid_initialize("./maps/jello.txt", 10, 30, &tiledNumPiles);
+  grid_setVectorRays(true);
+  grid_setEngine(NULL);
+  grid_setTiledTerrain(false);
+  printf("Table built over tiles differs at %d spot(s).\n", countDifferingViews(secondGrid, tiledGrid));
+  printf("Views cast over tiles differ at %d spot(s) with vector rays, %d with scalar.\n",
+         countDifferingViews(secondGrid, tiledRayGrid), countDifferingViews(secondGrid, tiledScalarGrid));
+  grid_delete(tiledGrid);
+  grid_delete(tiledRayGrid);
+  grid_delete(tiledScalarGrid);
+
+  printf("\nTest setEngine with unknown engine:\n");
+  if (grid_setEngine("magic")) {
+    fprintf(stderr, "setEngine accepted an unknown engine.\n");
+    return 1;
+  }
+  printf("Correctly rejected unknown engine.\n");
+  printf("Test every engine against the full table:\n");
+  const char* engines[] = {"table", "runs", "cache", "rays"};
+  for (int e = 0; e < 4; e++) {
+    grid_setEngine(engines[e]);
+    int engineNumPiles;
+    grid_t* engineGrid = grid_initialize("./maps/jello.txt", 10, 30, &engineNumPiles);
+    printf("Engine %s: views differ at %d spot(s).\n", grid_getEngine(engineGrid), countDifferingViews(secondGrid, engineGrid));
+    grid_delete(engineGrid);
+  }
+  printf("Test an engine over budget falls back to the cache:\n");
+  grid_setEngine("table");
+  grid_setTableBudget(1000);
+  int fallbackNumPiles;
+  grid_t* fallbackGrid = grid_initialize("./maps/jello.txt", 10, 30, &fallbackNumPiles);
+  printf("Asked for table, got %s.\n", grid_getEngine(fallbackGrid));
+  grid_delete(fallbackGrid);
+  grid_setTableBudget(64L * 1024 * 1024);
+  grid_setEngine(NULL);
+
   printf("\nDeleting new grid.\n");
   free(secondNumPiles);
   grid_delete(secondGrid);
 
+  printf("\nTest FOV cache on a map with no visibility table budget:\n");
+  FILE* bigMapFile = fopen("./gridtest-big.txt", "w");  // one 160x160 room
+  for (int r = 0; r < 162; r++) {
+    for (int c = 0; c < 162; c++) {
+      bool isEdgeRow = (r == 0 || r == 161);
+      bool isEdgeCol = (c == 0 || c == 161);
+      fputc(isEdgeRow && isEdgeCol ? '+' : isEdgeRow ? '-' : isEdgeCol ? '|' : '.', bigMapFile);
+    }
+    fputc('\n', bigMapFile);
+  }
+  fclose(bigMapFile);
+  int bigNumPiles;
+  grid_setTableBudget(0);
+  grid_t* bigGrid = grid_initialize("./gridtest-big.txt", 10, 30, &bigNumPiles);
+  remove("./gridtest-big.txt");
+  int bigCenter = 81 * grid_getNC(bigGrid) + 81;
+  long hits, misses;
+  char* firstView = grid_getVisible(bigGrid, bigCenter);
+  char* secondView = grid_getVisible(bigGrid, bigCenter);
+  grid_getCacheStats(bigGrid, &hits, &misses);
+  printf("Two views from one spot: %ld hit(s), %ld miss(es), views %s.\n", hits, misses,
+         strcmp(firstView, secondView) == 0 ? "match" : "differ");
+  free(firstView);
+  free(secondView);
+  printf("Test FOV cache disabled with a zero budget:\n");
+  grid_setCacheBudget(bigGrid, 0);
+  free(grid_getVisible(bigGrid, bigCenter));
+  grid_getCacheStats(bigGrid, &hits, &misses);
+  printf("After one more view: %ld hit(s), %ld miss(es).\n", hits, misses);
+  grid_delete(bigGrid);
+
+  printf("\nTest a budget that fits the visibility table but not its reverse as well:\n");
+  int budgetNumPiles;
+  grid_setTableBudget(64L * 1024 * 1024);
+  grid_t* fullGrid = grid_initialize("./maps/jello.txt", 10, 30, &budgetNumPiles);
+  long fullBytes;
+  grid_getBuildStats(fullGrid, &numThreads, &buildSeconds, &fullBytes);
+  grid_setTableBudget(fullBytes - 1);
+  grid_t* tightGrid = grid_initialize("./maps/jello.txt", 10, 30, &budgetNumPiles);
+  grid_setTableBudget(64L * 1024 * 1024);
+  grid_getBuildStats(tightGrid, &numThreads, &buildSeconds, &tableBytes);
+  printf("Both tables take %ld bytes with the %s engine; a byte less and it's the %s engine, %s budget.\n",
+         fullBytes, grid_getEngine(fullGrid), grid_getEngine(tightGrid), tableBytes < fullBytes ? "within" : "over");
+  grid_delete(fullGrid);
+  grid_delete(tightGrid);
+
+  printf("\nTest a line of sight exactly through a corner is blocked:\n");
+  int cornerNumPiles;
+  grid_t* cornerGrid = grid_initialize("./maps/main.txt", 0, 0, &cornerNumPiles);
+  int cornerColumns = grid_getNC(cornerGrid);
+  printf("Row 16, column 6 %s row 14, column 18 past the corner at row 15, column 12.\n",
+         grid_isVisiblePoint(cornerGrid, 14 * cornerColumns + 18, 16 * cornerColumns + 6) ? "sees" : "doesn't see");
+  grid_delete(cornerGrid);
+  printf("Test every line of sight on the bundled maps against their pinned fingerprints:\n");
+  const char* pinnedMaps[] = {"./maps/big.txt", "./maps/challenge.txt", "./maps/edges.txt", "./maps/fewspots.txt",
+                              "./maps/hole.txt", "./maps/jello.txt", "./maps/main.txt", "./maps/narrow.txt",
+                              "./maps/small.txt"};
+  for (int m = 0; m < sizeof(pinnedMaps) / sizeof(pinnedMaps[0]); m++) {
+    printSightFingerprint(pinnedMaps[m]);
+  }
+
+  printf("\nTest grid initialization with a map whose rows aren't all the same width:\n");
+  FILE* badMapFile = fopen("./gridtest-bad.txt", "w");
+  fputs("+----+\n|....|\n|.....|\n+----+\n", badMapFile);
+  fclose(badMapFile);
+  int badNumPiles;
+  grid_t* raggedGrid = grid_initialize("./gridtest-bad.txt", 1, 1, &badNumPiles);  // one pile, as it has few room spots
+  if (raggedGrid == NULL) {
+    fprintf(stderr, "failed to load a map with rows of different widths.\n");
+    return 1;
+  }
+  printf("Got %d rows of %d columns, short rows padded with rock:\n%s", grid_getNR(raggedGrid), grid_getNC(raggedGrid),
+         grid_getOriginalGrid(raggedGrid));
+  grid_delete(raggedGrid);
+  printf("Test grid initialization with a map with Windows line endings:\n");
+  badMapFile = fopen("./gridtest-bad.txt", "w");
+  fputs("+----+\r\n|....|\r\n+----+\r\n", badMapFile);
+  fclose(badMapFile);
+  fflush(stdout);  // so grid_initialize's error messages land in order in captured output
+  if (grid_initialize("./gridtest-bad.txt", 10, 30, &badNumPiles) != NULL) {
+    fprintf(stderr, "loaded a map with carriage returns.\n");
+    return 1;
+  }
+  remove("./gridtest-bad.txt");
+  printf("Test grid initialization with a map missing its final newline:\n");
+  grid_t* unterminatedGrid = grid_initialize("./maps/contrib/byteme.txt", 10, 30, &badNumPiles);
+  if (unterminatedGrid == NULL) {
+    fprintf(stderr, "failed to load a map missing its final newline.\n");
+    return 1;
+  }
+  printf("Got %d rows of %d columns, grid length %d\n", grid_getNR(unterminatedGrid), grid_getNC(unterminatedGrid),
+         grid_getLength(unterminatedGrid));
+  grid_delete(unterminatedGrid);
+
+  printf("\nTest views swept from the player, with room culling off, against views cast through rooms:\n");
+  grid_t* culledGrid = grid_initialize("./maps/jello.txt", 10, 30, &badNumPiles);
+  grid_setRoomCulling(false);
+  grid_t* sweptGrid = grid_initialize("./maps/jello.txt", 10, 30, &badNumPiles);
+  grid_setEngine("rays");
+  grid_t* sweptRayGrid = grid_initialize("./maps/jello.txt", 10, 30, &badNumPiles);
+  grid_setEngine(NULL);
+  grid_setRoomCulling(true);
+  // Only from room spots and passages: what a view from elsewhere holds is up to how it's cast
+  int numSweptDiffering = 0;
+  for (int idx = 0; idx < grid_getLength(culledGrid); idx++) {
+    char spot = grid_getOriginalChar(culledGrid, idx);
+    if (spot != '.' && spot != '#') {
+      continue;
+    }
+    char* culledView = grid_getVisible(culledGrid, idx);
+    char* sweptView = grid_getVisible(sweptGrid, idx);
+    char* sweptRayView = grid_getVisible(sweptRayGrid, idx);
+    for (int cell = 0; culledView[cell] != '\0'; cell++) {
+      if ((culledView[cell] == ' ') != (sweptView[cell] == ' ') || (culledView[cell] == ' ') != (sweptRayView[cell] == ' ')
+          || grid_canSeeAny(culledGrid, idx, &cell, 1) != grid_canSeeAny(sweptGrid, idx, &cell, 1)
+          || grid_canSeeAny(culledGrid, idx, &cell, 1) != grid_canSeeAny(sweptRayGrid, idx, &cell, 1)) {
+        numSweptDiffering++;
+        break;
+      }
+    }
+    free(culledView);
+    free(sweptView);
+    free(sweptRayView);
+  }
+  printf("Views swept, in a table and as asked for, differ at %d room spot(s) or passage(s).\n", numSweptDiffering);
+  grid_delete(culledGrid);
+  grid_delete(sweptGrid);
+  grid_delete(sweptRayGrid);
+
+  printf("\nTest tables built for a light radius of 5 against a radius of 5 set after load:\n");
+  grid_t* laterGrid = grid_initialize("./maps/jello.txt", 10, 30, &badNumPiles);
+  grid_setLightRadius(laterGrid, 5);
+  grid_setDefaultLightRadius(5);
+  grid_t* loadedGrid = grid_initialize("./maps/jello.txt", 10, 30, &badNumPiles);
+  grid_setDefaultLightRadius(0);
+  printf("Engine %s: views differ at %d spot(s).\n", grid_getEngine(loadedGrid), countDifferingViews(laterGrid, loadedGrid));
+  bool widened = grid_setLightRadius(loadedGrid, 6);
+  bool narrowed = grid_setLightRadius(loadedGrid, 4);
+  printf("Widening it to 6 %s, narrowing it to 4 %s.\n", widened ? "succeeded" : "was refused",
+         narrowed ? "succeeded" : "was refused");
+  grid_delete(laterGrid);
+  grid_delete(loadedGrid);
+
+  printf("\nTest renderPlayerStep against renderPlayerGrid along a walk through every room spot and passage:\n");
+  grid_t* walkGrid = grid_initialize("./maps/main.txt", 10, 30, &badNumPiles);
+  addr_t walkAddr = message_noAddr();
+  message_setAddr("localhost", "10804", &walkAddr);
+  player_t* walker = player_new(&walkAddr, "walker", 50);
+  grid_playerToGrid(walkGrid, walker, 'A');
+  int walkLength = grid_getLength(walkGrid);
+  char* patched = malloc(walkLength + 1);
+  char* rendered = malloc(walkLength + 1);
+  grid_renderPlayerGrid(walkGrid, walker, patched, walkLength + 1);
+  int numSteps = 0;
+  int numStepsDiffering = 0;
+  for (int idx = 0; idx < walkLength; idx++) {
+    char spot = grid_getOriginalChar(walkGrid, idx);
+    if (spot != '.' && spot != '#') {
+      continue;
+    }
+    // Step as the game does, taking any gold there
+    int from = player_getLoc(walker);
+    long version = grid_getVersion(walkGrid);
+    grid_updateMaster(walkGrid, from, '!');
+    grid_updateMaster(walkGrid, idx, 'A');
+    player_setLoc(walker, idx);
+    int changedIdxs[4];
+    int numChanged = grid_getChangesSince(walkGrid, version, changedIdxs, 4);
+    grid_renderPlayerStep(walkGrid, walker, from, changedIdxs, numChanged, patched, walkLength + 1);
+    grid_renderPlayerGrid(walkGrid, walker, rendered, walkLength + 1);
+    numSteps++;
+    numStepsDiffering += strcmp(patched, rendered) != 0;
+  }
+  printf("Patched %d step(s); %d differ from the grid rendered in full.\n", numSteps, numStepsDiffering);
+  printf("Test renderPlayerStep with changes that aren't known: %s\n",
+         grid_renderPlayerStep(walkGrid, walker, 0, NULL, -1, patched, walkLength + 1) && strcmp(patched, rendered) == 0
+         ? "rendered in full" : "failed");
+  free(patched);
+  free(rendered);
+  player_delete(walker);
+  grid_delete(walkGrid);
+}
+
+/* Count the spots of two grids of the same map whose views differ, in
+ * which cells are visible or in grid_canSeeAny; gold is placed at random,
+ * so what's in the cells isn't compared.
+ */
+static int
+countDifferingViews(grid_t* grid, grid_t* otherGrid)
+{
+  int numDiffering = 0;
+  for (int idx = 0; idx < grid_getNR(grid) * grid_getNC(grid); idx++) {
+    char* view = grid_getVisible(grid, idx);
+    char* otherView = grid_getVisible(otherGrid, idx);
+    for (int cell = 0; view[cell] != '\0'; cell++) {
+      if ((view[cell] == ' ') != (otherView[cell] == ' ')
+          || grid_canSeeAny(grid, idx, &cell, 1) != grid_canSeeAny(otherGrid, idx, &cell, 1)) {
+        numDiffering++;
+        break;
+      }
+    }
+    free(view);
+    free(otherView);
+  }
+  return numDiffering;
+}
+
+/* Print how many (player spot, cell) pairs of a map are visible by
+ * grid_isVisiblePoint, and a fingerprint (FNV-1a) of every answer in order,
+ * so any change to what can be seen on the map changes the output.
+ */
+static void
+printSightFingerprint(const char* mapFile)
+{
+  int numPiles;
+  grid_t* grid = grid_initialize((char*)mapFile, 0, 0, &numPiles);
+  if (grid == NULL) {
+    fprintf(stderr, "failed to load %s.\n", mapFile);
+    return;
+  }
+  long numVisible = 0;
+  uint64_t fingerprint = 14695981039346656037ULL;
+  for (int viewer = 0; viewer < grid_getLength(grid); viewer++) {
+    char viewerChar = grid_getOriginalChar(grid, viewer);
+    if (viewerChar != '.' && viewerChar != '#') {
+      continue;  // players only stand on room spots and passages
+    }
+    for (int cell = 0; cell < grid_getLength(grid); cell++) {
+      bool isVisible = grid_isVisiblePoint(grid, cell, viewer);
+      numVisible += isVisible;
+      fingerprint = (fingerprint ^ isVisible) * 1099511628211ULL;
+    }
+  }
+  printf("%s: %ld visible pairs, fingerprint %016llx\n", mapFile, numVisible, (unsigned long long)fingerprint);
+  grid_delete(grid);
 }
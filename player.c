@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <ctype.h>
 #include "player.h"
 
@@ -15,7 +16,8 @@
 typedef struct player {
   addr_t* address;
   char* name;
-  char* grid;
+  uint64_t* seen;      // bitset of every grid index the player has seen
+  int numCells;        // number of grid indices seen covers
   int purse;
   int location;
   bool status;
@@ -45,12 +47,12 @@ player_getName(player_t* player) {
   return NULL;  // error
 }
 
-char*
-player_getGrid(player_t* player) {
-   if (player != NULL && player->grid != NULL){
-    return player->grid;
+uint64_t*
+player_getSeen(player_t* player) {
+  if (player != NULL && player->seen != NULL){
+    return player->seen;
   }
-   return NULL; // error
+  return NULL;  // error
 }
 
 int
@@ -81,22 +83,20 @@ player_getStatus(player_t* player) {
 /* setter functions - see player.h for documentation */
 
 bool
-player_setGrid(player_t* player, char* newGrid) {
+player_clearSeen(player_t* player, int numCells) {
 
   // check params
-  if (player != NULL && newGrid != NULL) {
-    if (player_getGrid(player) != NULL) {
-      free(player->grid);
-    }
-    // allocate memory for new grid, copy param and assign pointer
-    char* cpGrid = malloc(strlen(newGrid) + 1);
-    if (cpGrid != NULL){
-      strcpy(cpGrid, newGrid);
-      player->grid = cpGrid;
+  if (player != NULL && numCells > 0) {
+    // allocate a cleared bit for every index, rounded up to whole words
+    uint64_t* newSeen = calloc((numCells + 63) / 64, sizeof(uint64_t));
+    if (newSeen != NULL){
+      free(player->seen);
+      player->seen = newSeen;
+      player->numCells = numCells;
       return true;
     }
     else {       // memory allocation error
-      fprintf(stderr, "player_setGrid: error allocating memory for grid");
+      fprintf(stderr, "player_clearSeen: error allocating memory for seen bitset\n");
       return false;
     }
   }
@@ -121,7 +121,7 @@ player_setLoc(player_t* player, int newLoc) {
 
   // check params, only allow if player has name
   if (player != NULL && strlen(player->name) > 0 && newLoc >= 0
-      && newLoc < strlen(player->grid)) {
+      && newLoc < player->numCells) {
 
     // set new location
     player->location = newLoc;
@@ -172,8 +172,9 @@ player_new(addr_t* add, char* name, const int maxNameLength)
       return NULL;                                       // error allocating memory
     } else player->name = newName;
 
-    // grid initialized externally
-    player->grid = NULL;
+    // seen bitset initialized externally, once the grid size is known
+    player->seen = NULL;
+    player->numCells = 0;
 
     // location initialized -1 for external error checking
     player->location = -1;
@@ -262,8 +263,8 @@ player_delete(player_t* player)
   if (player != NULL) {
     free(player->name);          // allocated by player_new
     free(player->address);       // allocated by player_new
-    if (player->grid != NULL) {  // only free grid if allocated externally
-      free(player->grid);
+    if (player->seen != NULL) {  // only free seen if allocated externally
+      free(player->seen);
     }
     free(player);                // allocated by player_new
   }
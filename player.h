@@ -5,6 +5,7 @@
  */
 
 #include <stdio.h>
+#include <stdint.h>
 #include "message.h"
 
 /************** global types **************/
@@ -36,17 +37,17 @@ addr_t* player_getAddr(player_t* player);
  */
 char* player_getName(player_t* player);
 
-/************ player_getGrid *************/
-/* Returns a player's grid.
+/************ player_getSeen *************/
+/* Returns the cells a player has ever seen.
  *
  * Caller provides: 
  *   valid pointer to a player
  *
  * We return:
- *   the player's grid
- *   NULL if the player or its grid are NULL
+ *   the player's seen bitset, one bit per grid index (bit i%64 of word i/64)
+ *   NULL if the player or its bitset are NULL
  */ 
-char* player_getGrid(player_t* player);
+uint64_t* player_getSeen(player_t* player);
 
 /************ player_getPurse **************/
 /* Returns a player's purse.
@@ -86,21 +87,20 @@ bool player_getStatus(player_t* player);
 
 /************** setters **************/
 
-/************** player_setGrid *************/
-/* Sets a given player's grid pointer to a new grid.
+/************** player_clearSeen *************/
+/* Gives a player an empty seen bitset for a grid of the given size.
  *
  * Caller provides:
- *   valid pointer to a player, valid string pointer to a new grid
+ *   valid pointer to a player, number of indices in the grid
  *
  * We return:
  *   true if successful, false otherwise
  * We guarantee:
- *   player and new grid non null
- *   player's grid pointer set to new grid otherwise
- *   free player's old grid if existent
- *   we make a copy of new grid, thus caller is responsible for parameter passed to us
+ *   player non null, numCells > 0
+ *   free player's old bitset if existent
+ *   every bit of the new bitset starts cleared, i.e., nothing seen yet
  */
-bool player_setGrid(player_t* player, char* newGrid);
+bool player_clearSeen(player_t* player, int numCells);
 
 /************** player_addPurse *************/
 /* Adds gold to a player's purse.
@@ -127,7 +127,7 @@ bool player_addPurse(player_t* player, int newGold);
  *   true if successful, false otherwise
  * We guarantee:
  *   a spectator may not set their location
- *   player non null, new location a valid index in grid string
+ *   player non null, new location a valid index in the grid the seen bitset was cleared for
  *   player's location set to new location otherwise
  */
 bool player_setLoc(player_t* player, int newLoc);
@@ -162,7 +162,7 @@ bool player_quitGame(player_t* player);
  *   address is valid and non null, name is non null, maxNameLength > 0
  *   name is normalized according to Requirements Spec
  *   name is copied, so caller is free to later modify parameter passed
- *   grid starts NULL, location starts -1
+ *   seen bitset starts NULL, location starts -1
  *   purse starts empty, status starts true
  *   return NULL if param or memory allocation errors
  * Caller is responsible for:
@@ -200,7 +200,7 @@ char* player_summary(player_t* player, int id);
  * 
  * We guarantee:
  *   the player's address and name are freed
- *   if memory has been externally allocated for the grid, the grid is freed
+ *   the seen bitset is freed if it was allocated
  *   the player itself is freed
  */
 void player_delete(player_t* player);
@@ -59,31 +59,32 @@ main(const int argc, char* argv[])
     exit(5);
   } else printf("success: player_getName() returns %s\n", player_getName(player));
 
-  // we have yet to set the player's grid, so should return the empty string
-  if (player_getGrid(player) != NULL) {
-    fprintf(stderr, "error: player_getGrid() NULL not returned\n");
+  // we have yet to clear the player's seen bitset, so should return NULL
+  if (player_getSeen(player) != NULL) {
+    fprintf(stderr, "error: player_getSeen() NULL not returned\n");
     exit(6);
-  } else printf("success: player_getGrid() returned NULL\n");
+  } else printf("success: player_getSeen() returned NULL\n");
     
-  // player grid is initially empty, so setting it should work
-  char* grid = "this is a grid";
-  if (!player_setGrid(player, grid)) {
-    fprintf(stderr, "error: player_setGrid() initial call\n");
+  // player bitset is initially NULL, so clearing it should work
+  int numCells = 100;
+  if (!player_clearSeen(player, numCells)) {
+    fprintf(stderr, "error: player_clearSeen() initial call\n");
     exit(7);
-  } else printf("success: player_setGrid() initial call grid: %s\n", grid);
+  } else printf("success: player_clearSeen() initial call with %d cells\n", numCells);
 
-  // should be able to overwrite grid
-  grid = "this grid good";
-  if (!player_setGrid(player, grid)) {
-    fprintf(stderr, "error: player_setGrid()\n");
+  // mark a cell seen, then should be able to replace the bitset
+  player_getSeen(player)[1] = 1;
+  numCells = 14;
+  if (!player_clearSeen(player, numCells)) {
+    fprintf(stderr, "error: player_clearSeen()\n");
     exit(8);
-  } else printf("success: player_setGrid() with new grid: %s\n", grid);
+  } else printf("success: player_clearSeen() with new size %d\n", numCells);
 
-  // we've set the player's grid, so should give us the proper grid
-  if (!strcmp(player_getGrid(player), "")) {
-    fprintf(stderr, "error: player_getGrid()\n");
+  // we've cleared the player's bitset, so nothing should be seen yet
+  if (player_getSeen(player) == NULL || player_getSeen(player)[0] != 0) {
+    fprintf(stderr, "error: player_getSeen()\n");
     exit(9);
-  } else printf("success: player_getGrid() returns %s\n", player_getGrid(player));
+  } else printf("success: player_getSeen() returns an empty bitset\n");
 
   // player's purse should be empty
   if (player_getPurse(player)) {
@@ -138,7 +139,7 @@ main(const int argc, char* argv[])
   } else printf("success: player_getLoc() with unchanged location\n");
 
   // change location with valid input
-  int loc = strlen(player_getGrid(player)) / 2;
+  int loc = numCells / 2;
   if (!player_setLoc(player, loc)) {
     fprintf(stderr, "error: player_setLoc() with valid location\n");
     exit(18);
@@ -152,12 +153,12 @@ main(const int argc, char* argv[])
   } else printf("success: player_setLoc() did not set negative location %d\n", loc);
 
   // should not be able to change location out of bounds
-  loc = strlen(player_getGrid(player)) + 1;
+  loc = numCells + 1;
   if (player_setLoc(player, loc)) {
     fprintf(stderr, "error: player_setLoc() set out of bounds location\n");
     exit(20);
   } else printf("success: player_setLoc() did not set out of bounds %d > %d\n", loc,
-                (int) (strlen(player_getGrid(player)) - 1));
+                numCells - 1);
 
   // get location should be what we set
   if (player_getLoc(player) == -1) {
@@ -259,10 +260,10 @@ main(const int argc, char* argv[])
     exit(33);
   } else printf("success: player_getName() blocks null player\n");
 
-  if (player_getGrid(ghost) != NULL) {
-    fprintf(stderr, "error: player_getGrid() took null player\n");
+  if (player_getSeen(ghost) != NULL) {
+    fprintf(stderr, "error: player_getSeen() took null player\n");
     exit(34);
-  } else printf("success: player_getGrid() blocks null player\n");
+  } else printf("success: player_getSeen() blocks null player\n");
 
   if (player_getPurse(ghost) != -1) {
     fprintf(stderr, "error: player_getPurse() took null player\n");
@@ -279,12 +280,12 @@ main(const int argc, char* argv[])
     exit(37);
   } else printf("success: player_getStatus() blocks null player\n");
 
-  // valid grid
-  grid = "this is a valid grid";
-  if (player_setGrid(ghost, grid)) {
-    fprintf(stderr, "error: player_setGrid() took null player\n");
+  // valid grid size
+  numCells = 20;
+  if (player_clearSeen(ghost, numCells)) {
+    fprintf(stderr, "error: player_clearSeen() took null player\n");
     exit(38);
-  } else printf("success: player_setGrid() blocks null player\n");
+  } else printf("success: player_clearSeen() blocks null player\n");
 
   // valid gold amt
   goldToAdd = 12;
@@ -316,11 +317,11 @@ main(const int argc, char* argv[])
 
   // test setter functions on spectator
 
-  // spectator should be able to setGrid
-  if (!player_setGrid(spectator, grid)) {
-    fprintf(stderr, "error: player_setGrid() does not allow spectator grid\n");
+  // spectator should be able to clearSeen
+  if (!player_clearSeen(spectator, numCells)) {
+    fprintf(stderr, "error: player_clearSeen() does not allow spectator bitset\n");
     exit(43);
-  } else printf("success: player_setGrid() allows spectator to set grid\n");
+  } else printf("success: player_clearSeen() allows spectator to clear bitset\n");
   
   // spectator should not be able to addPurse
   if (player_addPurse(spectator, goldToAdd)) {
@@ -329,7 +330,7 @@ main(const int argc, char* argv[])
   } else printf("success: player_addPurse() blocks spectator\n");
 
   // spectator should not be able to setLoc
-  loc = strlen(grid) / 2;
+  loc = numCells / 2;
   if (player_setLoc(spectator, loc)) {
     fprintf(stderr, "error: player_setLoc() allows spectator location\n");
     exit(45);
@@ -9,6 +9,7 @@
  #include <string.h>
  #include <ctype.h>
  #include <stdbool.h>
+ #include <limits.h>
  #include <unistd.h>
  #include "grid.h"
  #include "game.h"
@@ -18,7 +19,8 @@
 static game_t* game;
 
 /**************** local functions ****************/
-static int parseArgs(const int argc, char* argv[], char** mapFile);
+static int parseArgs(const int argc, char* argv[], char** mapFile, int* lightRadius,
+                     int* buildThreads, char** engine, long* memoryBudget);
 static int playGame(FILE* logfile);
 static bool handleClientMessage(void* arg, const addr_t from, const char* message);
 
@@ -29,13 +31,32 @@ int
 main(const int argc, char* argv[]) {
   
   char* mapFile = NULL;
+  int lightRadius = 0;                          // no limit unless given
+  int buildThreads = 0;                         // one per core unless given
+  char* engine = NULL;                          // best within budget unless given
+  long memoryBudget = 0;                        // grid's default unless given
 
-  if (!parseArgs(argc, argv, &mapFile)) {       // parse arguments
+  if (!parseArgs(argc, argv, &mapFile, &lightRadius, &buildThreads, &engine, &memoryBudget)) {  // parse arguments
     
+    grid_setBuildThreads(buildThreads);         // visibility tables are built by game_new
+    grid_setEngine(engine);
+    grid_setDefaultLightRadius(lightRadius);    // limit how far players see, so tables are built for it
+    if (memoryBudget > 0 && !grid_setTableBudget(memoryBudget)) {
+      fprintf(stderr, "error setting the memory budget\n");
+      return 3;                                 // same as a bad -m
+    }
     if ((game = game_new(mapFile)) == NULL) {   // initialize game
       fprintf(stderr, "error initializing game from mapfile\n");
       return 1;                                 // game initialization error
     }
+    const char* engineName;
+    int numThreads;
+    double buildSeconds;
+    long memoryBytes;
+    if (game_getBuildStats(game, &engineName, &numThreads, &buildSeconds, &memoryBytes)) {
+      fprintf(stderr, "visibility engine %s: built on %d thread(s) in %.3f seconds, %ld bytes\n",
+              engineName, numThreads, buildSeconds, memoryBytes);
+    }
     
     if (playGame(stderr) != 0) {                // begin gameplay
       fprintf(stderr, "error initializing the network\n");
@@ -50,21 +71,75 @@ main(const int argc, char* argv[]) {
 /* Parses and handles command line arguments, setting appropriate pointers.
  *
  * Caller provides:
- *   number of args, argc; array of args, argv; pointer to mapFile
+ *   number of args, argc; array of args, argv; pointer to mapFile;
+ *   pointer to lightRadius; pointer to buildThreads; pointer to engine;
+ *   pointer to memoryBudget
+ *
+ * Usage:
+ *   server map.txt [seed] [-l lightRadius] [-t buildThreads] [-e engine] [-m megabytes]
  *
  * We guarantee:
  *   if wrong number of args, return nonzero
  *   mapFile pointer set to second arg
- *   if third arg (seed) provided, passed to srand, 
+ *   if seed provided, passed to srand, 
  *    else pass getpid() as required
+ *   if -l given with a positive radius, lightRadius set to it,
+ *    else left unchanged; a bad radius returns nonzero
+ *   if -t given with a positive count, buildThreads set to it,
+ *    else left unchanged; a bad count returns nonzero
+ *   if -e given with an engine grid_setEngine knows, engine set to it,
+ *    else left unchanged; an unknown engine returns nonzero
+ *   if -m given with a positive number of megabytes, memoryBudget set
+ *    to that many bytes, else left unchanged; a bad number, or one too
+ *    big to count in bytes, returns nonzero
+ *   options may come in either order; an unknown one returns nonzero
  *
  * We return:
  *   0 if successful, nonzero otherwise
  */
 static int
-parseArgs(const int argc, char* argv[], char** mapFile){
+parseArgs(const int argc, char* argv[], char** mapFile, int* lightRadius,
+          int* buildThreads, char** engine, long* memoryBudget){
+
+  // options, if any, come last, each a flag followed by its value
+  int numArgs = argc;
+  while (numArgs >= 4 && argv[numArgs - 2][0] == '-') {
+    char* flag = argv[numArgs - 2];
+    if (!strcmp(flag, "-l")) {
+      if (sscanf(argv[numArgs - 1], "%d", lightRadius) != 1 || *lightRadius <= 0) {
+        fprintf(stderr, "invalid light radius\n");
+        return 1;
+      }
+    }
+    else if (!strcmp(flag, "-t")) {
+      if (sscanf(argv[numArgs - 1], "%d", buildThreads) != 1 || *buildThreads <= 0) {
+        fprintf(stderr, "invalid number of threads\n");
+        return 1;
+      }
+    }
+    else if (!strcmp(flag, "-e")) {
+      *engine = argv[numArgs - 1];
+      if (!grid_setEngine(*engine)) {
+        fprintf(stderr, "unknown engine %s (table, runs, cache, rays or auto)\n", *engine);
+        return 1;
+      }
+    }
+    else if (!strcmp(flag, "-m")) {
+      if (sscanf(argv[numArgs - 1], "%ld", memoryBudget) != 1 || *memoryBudget <= 0
+          || *memoryBudget > LONG_MAX / (1024 * 1024)) {
+        fprintf(stderr, "invalid memory budget\n");
+        return 1;
+      }
+      *memoryBudget *= 1024 * 1024;
+    }
+    else {
+      fprintf(stderr, "unknown option %s\n", flag);
+      return 1;
+    }
+    numArgs -= 2;
+  }
 
-  if (argc != 2 && argc != 3) {
+  if (numArgs != 2 && numArgs != 3) {
     fprintf(stderr, "invalid number of arguments");
     return 1;
   }
@@ -72,7 +147,7 @@ parseArgs(const int argc, char* argv[], char** mapFile){
   // can assume mapfile is valid
   *mapFile = argv[1];
 
-  if (argc == 3) {          // seed provided
+  if (numArgs == 3) {       // seed provided
     int seed;
     sscanf(argv[2], "%d", &seed);
     srand(seed);